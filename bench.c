@@ -0,0 +1,84 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Times drw_text() on ASCII, mixed-script and emoji text, measuring widths
+ * and drawing: make bench && ./bench [font] */
+#include <poll.h>
+#include <time.h>
+
+#include "drw.c"
+
+#define N 200000
+
+static const char *texts[][2] = {
+	{ "ascii", "dwm-6.1 | load 0.42 | cpu 12% | mem 34% | Mon 19 Oct 14:02 | ~/src/dwm: vim drw.c" },
+	{ "mixed", "Zürich – Ελληνικά – русский текст – 日本語のタイトル – عربي" },
+	{ "emoji", "build ✅ tests ❌ 😀😃😄😁😆😅🤣😂🙂🙃😉😊😇🥰😍" },
+};
+
+static volatile size_t sink;
+
+static double
+ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double
+text(Drw *drw, const char *s, int render, int n)
+{
+	double t = ns();
+	int i;
+
+	for (i = 0; i < n; i++)
+		sink = render ? drw_text(drw, 1, 0, 2000, 20, 0, s, 0)
+		              : drw_text(drw, 0, 0, 0, 0, 0, s, 0);
+	if (render)
+		XSync(drw->dpy, False);
+	return (ns() - t) / n;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *fonts[] = { argc > 1 ? argv[1] : "monospace:size=10" };
+	const char *colors[] = { "#bbbbbb", "#222222", "#444444" };
+	struct pollfd pfd;
+	Display *dpy;
+	Drw *drw;
+	Buf *buf;
+	Clr *scm;
+	size_t i, len;
+	double width;
+
+	if (!(dpy = XOpenDisplay(NULL)))
+		die("bench: cannot open display");
+	drw = drw_create(dpy, DefaultScreen(dpy), RootWindow(dpy, DefaultScreen(dpy)));
+	if (!drw_fontset_create(drw, fonts, LENGTH(fonts)))
+		die("bench: cannot load font '%s'", fonts[0]);
+	drw_setbuf(drw, buf = drw_buf_create(drw, 2000, 20));
+	drw_setscheme(drw, scm = drw_scm_create(drw, colors, LENGTH(colors)));
+
+	/* let the worker find the fallback fonts first */
+	do {
+		for (i = 0; i < LENGTH(texts); i++)
+			drw_text(drw, 0, 0, 0, 0, 0, texts[i][1], 0);
+		pfd.fd = drw->workfd;
+		pfd.events = POLLIN;
+	} while (drw->fbjobs && poll(&pfd, 1, 5000) > 0 && drw_collect(drw) >= 0);
+
+	printf("%-6s %6s %12s %12s %12s\n", "text", "bytes", "width ns", "draw ns", "width ns/B");
+	for (i = 0; i < LENGTH(texts); i++) {
+		len = strlen(texts[i][1]);
+		width = text(drw, texts[i][1], 0, N / 10);
+		printf("%-6s %6zu %12.0f %12.0f %12.2f\n", texts[i][0], len,
+		       width, text(drw, texts[i][1], 1, N / 100), width / len);
+	}
+	drw_buf_free(drw, buf);
+	free(scm);
+	drw_free(drw);
+	XCloseDisplay(dpy);
+	return 0;
+}
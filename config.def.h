@@ -5,6 +5,10 @@ static const unsigned int borderpx  = 1;        /* border pixel of windows */
 static const unsigned int snap      = 32;       /* snap pixel */
 static const int showbar            = 1;        /* 0 means no bar */
 static const int topbar             = 1;        /* 0 means bottom bar */
+static const char *statusfifo       = NULL;     /* status input, e.g. "/run/user/1000/dwm-status" */
+static const int statusdelay        = 250;      /* min. ms between status updates from statusfifo */
+static const int titledelay         = 50;       /* min. ms between title updates of a window */
+static const int logstartup         = 0;        /* 1 means log time and X requests of startup phases */
 static const char *fonts[]          = { "monospace:size=10" };
 static const char dmenufont[]       = "monospace:size=10";
 static const char col_gray1[]       = "#222222";
@@ -18,6 +22,19 @@ static const char *colors[][3]      = {
 	[SchemeSel]  = { col_gray4, col_cyan,  col_cyan  },
 };
 
+/* status modules, shown after the status text; entries without a function
+ * are skipped, so that the table need not be empty when none are used */
+static const Module modules[] = {
+	/* function       format        argument                                  interval (ms) */
+	{ NULL },
+	/* { load_avg,       " %s",        NULL,                                     5000 }, */
+	/* { cpu_perc,       " cpu %s%%",  NULL,                                     2000 }, */
+	/* { ram_perc,       " mem %s%%",  NULL,                                     5000 }, */
+	/* { temp,           " %s°C",      "/sys/class/thermal/thermal_zone0/temp",  5000 }, */
+	/* { battery_perc,   " bat %s%%",  "BAT0",                                   30000 }, */
+	/* { datetime,       " %s",        "%a %d %b %H:%M",                         1000 }, */
+};
+
 /* tagging */
 static const char *tags[] = { "1", "2", "3", "4", "5", "6", "7", "8", "9" };
 
@@ -25,6 +42,8 @@ static const Rule rules[] = {
 	/* xprop(1):
 	 *	WM_CLASS(STRING) = instance, class
 	 *	WM_NAME(STRING) = title
+	 * patterns match substrings, "=text" the whole string and
+	 * "~regex" an extended regular expression
 	 */
 	/* class      instance    title       tags mask     isfloating   monitor */
 	{ "Gimp",     NULL,       NULL,       0,            1,           -1 },
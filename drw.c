@@ -1,15 +1,27 @@
 /* See LICENSE file for copyright and license details. */
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <X11/Xlib.h>
 #include <X11/Xft/Xft.h>
+#ifdef SHM
+#include <stdint.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif /* SHM */
 
 #include "drw.h"
 #include "util.h"
 
 #define UTF_INVALID 0xFFFD
 #define UTF_SIZ     4
+#define GLYPHMEM    (1024 * 1024) /* Xft default per font */
+#define ATLASW      2048 /* width of the sprite atlas */
+#define ROW(B, Y)   ((uint32_t *)((B)->img->data + (Y) * (B)->img->bytes_per_line))
 
 static const unsigned char utfbyte[UTF_SIZ + 1] = {0x80,    0, 0xC0, 0xE0, 0xF0};
 static const unsigned char utfmask[UTF_SIZ + 1] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
@@ -44,6 +56,10 @@ utf8decode(const char *c, long *u, size_t clen)
 	*u = UTF_INVALID;
 	if (!clen)
 		return 0;
+	if (!(c[0] & 0x80)) { /* ASCII, no need to walk the tables */
+		*u = c[0];
+		return 1;
+	}
 	udecoded = utf8decodebyte(c[0], &len);
 	if (!BETWEEN(len, 1, UTF_SIZ))
 		return 1;
@@ -60,17 +76,273 @@ utf8decode(const char *c, long *u, size_t clen)
 	return len;
 }
 
+static Fnt nofont;  /* marks codepoints without any font */
+static Fnt pending; /* marks codepoints the worker looks for a font for */
+
+/* drop what shows text, as glyphs have changed */
+static void
+ext_clear(Drw *drw)
+{
+	size_t i;
+
+	for (i = 0; i < LENGTH(drw->extcache); i++) {
+		free(drw->extcache[i].text);
+		drw->extcache[i].text = NULL;
+	}
+	drw->nsprites = drw->atlasx = 0;
+}
+
+/* drop everything derived from the current fontset */
+static void
+cache_clear(Drw *drw)
+{
+	size_t i;
+
+	ext_clear(drw);
+	memset(drw->latin, 0, sizeof(drw->latin));
+	free(drw->chars);
+	drw->chars = NULL;
+	drw->nchars = drw->charsz = 0;
+	for (i = 0; i < LENGTH(drw->fallback); i++)
+		if (drw->fallback[i].xfont)
+			XftFontClose(drw->dpy, drw->fallback[i].xfont);
+	memset(drw->fallback, 0, sizeof(drw->fallback));
+	drw->fbhand = drw->nfallback = drw->fallbackmem = 0;
+#ifdef SHM
+	for (i = 0; i < LENGTH(drw->bmps); i++)
+		free(drw->bmps[i].bits);
+	memset(drw->bmps, 0, sizeof(drw->bmps));
+#endif
+}
+
+static Chr *
+chr_slot(Drw *drw, long cp)
+{
+	size_t i, mask = drw->charsz - 1;
+
+	for (i = (cp * 2654435761UL) & mask; drw->chars[i].font && drw->chars[i].cp != cp; i = (i + 1) & mask)
+		; /* NOP */
+	return &drw->chars[i];
+}
+
+static void
+chr_put(Drw *drw, long cp, Fnt *font)
+{
+	Chr *c, *old = drw->chars;
+	size_t i, oldsz = drw->charsz;
+
+	if (2 * (drw->nchars + 1) > drw->charsz) {
+		drw->charsz = oldsz ? oldsz * 2 : 64;
+		drw->chars = ecalloc(drw->charsz, sizeof(Chr));
+		for (i = 0; i < oldsz; i++)
+			if (old[i].font)
+				*chr_slot(drw, old[i].cp) = old[i];
+		free(old);
+	}
+	c = chr_slot(drw, cp);
+	if (!c->font)
+		drw->nchars++;
+	c->cp = cp;
+	c->font = font;
+	c->gen = font->gen;
+}
+
+static Chr *
+chr_get(Drw *drw, long cp)
+{
+	if (cp < LENGTH(drw->latin))
+		return &drw->latin[cp];
+	return drw->chars ? chr_slot(drw, cp) : NULL;
+}
+
+static void
+chr_set(Drw *drw, long cp, Fnt *font)
+{
+	if (cp < LENGTH(drw->latin)) {
+		drw->latin[cp].font = font;
+		drw->latin[cp].gen = font->gen;
+	} else {
+		chr_put(drw, cp, font);
+	}
+}
+
+#ifdef SHM
+static int shmerror;
+
+static int
+xerrorshm(Display *dpy, XErrorEvent *ee)
+{
+	shmerror = 1;
+	return 0;
+}
+
+/* An XImage in shared memory, if the server is local and uses 32 bit
+ * pixels of 8 bit channels in our byte order. */
+static XImage *
+shm_create(Drw *drw, unsigned int w, unsigned int h, XShmSegmentInfo *shm)
+{
+	Visual *vis = DefaultVisual(drw->dpy, drw->screen);
+	XErrorHandler xerror;
+	XImage *img;
+	int one = 1;
+
+	if (!XShmQueryExtension(drw->dpy) || vis->class != TrueColor
+	|| vis->red_mask != 0xff0000 || vis->green_mask != 0xff00 || vis->blue_mask != 0xff)
+		return NULL;
+	if (!(img = XShmCreateImage(drw->dpy, vis, DefaultDepth(drw->dpy, drw->screen),
+	                            ZPixmap, NULL, shm, w, h)))
+		return NULL;
+	if (img->bits_per_pixel != 32 || img->byte_order != (*(char *)&one ? LSBFirst : MSBFirst)
+	|| (shm->shmid = shmget(IPC_PRIVATE, img->bytes_per_line * h, IPC_CREAT | 0600)) == -1) {
+		XDestroyImage(img);
+		return NULL;
+	}
+	shm->shmaddr = img->data = shmat(shm->shmid, NULL, 0);
+	shm->readOnly = False;
+	if (shm->shmaddr == (char *)-1) {
+		shmctl(shm->shmid, IPC_RMID, NULL);
+		img->data = NULL;
+		XDestroyImage(img);
+		return NULL;
+	}
+	/* attaching fails on remote displays */
+	XSync(drw->dpy, False);
+	shmerror = 0;
+	xerror = XSetErrorHandler(xerrorshm);
+	XShmAttach(drw->dpy, shm);
+	XSync(drw->dpy, False);
+	XSetErrorHandler(xerror);
+	/* removed once detached by both; not before the server attached it,
+	 * which only Linux allows */
+	shmctl(shm->shmid, IPC_RMID, NULL);
+	if (shmerror) {
+		shmdt(shm->shmaddr);
+		img->data = NULL;
+		XDestroyImage(img);
+		return NULL;
+	}
+	return img;
+}
+
+#endif /* SHM */
+
+struct Job {
+	FcPattern *pattern; /* substituted, to be matched */
+	FcPattern *match;   /* what the worker found, or NULL */
+	const char *name;   /* of a font in the fontset */
+	long cp;            /* of a fallback search, or -1 */
+	struct Job *next;
+};
+
+struct Worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct Job *jobs, **tail;
+	int quit;
+	int fd[2];          /* the worker writes done jobs to fd[1] */
+};
+
+/* Runs FcFontMatch, which may scan every font on the system, away from
+ * the event loop. */
+static void *
+work(void *arg)
+{
+	struct Worker *w = arg;
+	struct Job *j;
+	FcResult result;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (!w->jobs && !w->quit)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (w->quit)
+			break;
+		j = w->jobs;
+		if (!(w->jobs = j->next))
+			w->tail = &w->jobs;
+		pthread_mutex_unlock(&w->lock);
+		j->match = FcFontMatch(NULL, j->pattern, &result);
+		while (write(w->fd[1], &j, sizeof j) == -1)
+			; /* EINTR */
+		pthread_mutex_lock(&w->lock);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+static void
+job_add(Drw *drw, FcPattern *pattern, const char *name, long cp)
+{
+	struct Worker *w;
+	struct Job *j;
+
+	if (!(w = drw->worker)) {
+		w = drw->worker = ecalloc(1, sizeof(struct Worker));
+		w->tail = &w->jobs;
+		if (pipe(w->fd) == -1)
+			die("pipe:");
+		fcntl(w->fd[0], F_SETFL, O_NONBLOCK);
+		fcntl(w->fd[0], F_SETFD, FD_CLOEXEC);
+		fcntl(w->fd[1], F_SETFD, FD_CLOEXEC);
+		pthread_mutex_init(&w->lock, NULL);
+		pthread_cond_init(&w->cond, NULL);
+		if (pthread_create(&w->thread, NULL, work, w))
+			die("pthread_create:");
+		drw->workfd = w->fd[0];
+	}
+	j = ecalloc(1, sizeof(struct Job));
+	j->pattern = pattern;
+	j->name = name;
+	j->cp = cp;
+	pthread_mutex_lock(&w->lock);
+	*w->tail = j;
+	w->tail = &j->next;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void
+job_free(struct Job *j)
+{
+	FcPatternDestroy(j->pattern);
+	if (j->match)
+		FcPatternDestroy(j->match);
+	free(j);
+}
+
+static void
+worker_free(struct Worker *w)
+{
+	struct Job *j;
+
+	pthread_mutex_lock(&w->lock);
+	w->quit = 1;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+	while (read(w->fd[0], &j, sizeof j) == sizeof j)
+		job_free(j);
+	for (; w->jobs; w->jobs = j) {
+		j = w->jobs->next;
+		job_free(w->jobs);
+	}
+	close(w->fd[0]);
+	close(w->fd[1]);
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->cond);
+	free(w);
+}
+
 Drw *
-drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h)
+drw_create(Display *dpy, int screen, Window root)
 {
 	Drw *drw = ecalloc(1, sizeof(Drw));
 
 	drw->dpy = dpy;
 	drw->screen = screen;
 	drw->root = root;
-	drw->w = w;
-	drw->h = h;
-	drw->drawable = XCreatePixmap(dpy, root, w, h, DefaultDepth(dpy, screen));
+	drw->workfd = -1;
 	drw->gc = XCreateGC(dpy, root, 0, NULL);
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter);
 
@@ -78,24 +350,60 @@ drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h
 }
 
 void
-drw_resize(Drw *drw, unsigned int w, unsigned int h)
+drw_free(Drw *drw)
 {
-	if (!drw)
-		return;
+	if (drw->worker)
+		worker_free(drw->worker);
+	XFreeGC(drw->dpy, drw->gc);
+	cache_clear(drw);
+	drw_buf_free(drw, drw->atlas);
+	free(drw);
+}
+
+Buf *
+drw_buf_create(Drw *drw, unsigned int w, unsigned int h)
+{
+	Buf *buf;
+
+	if (!drw || !(buf = ecalloc(1, sizeof(Buf))))
+		return NULL;
 
-	drw->w = w;
-	drw->h = h;
-	if (drw->drawable)
-		XFreePixmap(drw->dpy, drw->drawable);
-	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
+	buf->w = w;
+	buf->h = h;
+#ifdef SHM
+	if ((buf->img = shm_create(drw, w, h, &buf->shm)))
+		return buf;
+#endif
+	buf->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
+	buf->xftdraw = XftDrawCreate(drw->dpy, buf->drawable,
+	                             DefaultVisual(drw->dpy, drw->screen),
+	                             DefaultColormap(drw->dpy, drw->screen));
+
+	return buf;
 }
 
 void
-drw_free(Drw *drw)
+drw_buf_free(Drw *drw, Buf *buf)
 {
-	XFreePixmap(drw->dpy, drw->drawable);
-	XFreeGC(drw->dpy, drw->gc);
-	free(drw);
+	if (!buf)
+		return;
+
+	if (drw->buf == buf)
+		drw->buf = NULL;
+#ifdef SHM
+	if (buf->img) {
+		XShmDetach(drw->dpy, &buf->shm);
+		XSync(drw->dpy, False);
+		shmdt(buf->shm.shmaddr);
+		buf->img->data = NULL;
+		XDestroyImage(buf->img);
+		free(buf);
+		return;
+	}
+#endif
+	XftDrawDestroy(buf->xftdraw);
+	XFreePixmap(drw->dpy, buf->drawable);
+	free(buf);
 }
 
 /* This function is an implementation detail. Library users should use
@@ -152,6 +460,170 @@ xfont_free(Fnt *font)
 	free(font);
 }
 
+static unsigned int
+xfont_advance(Fnt *font, long cp)
+{
+	XGlyphInfo ext;
+	FT_UInt glyph;
+
+	if (cp < LENGTH(font->adv) && font->adv[cp])
+		return font->adv[cp] - 1;
+	glyph = XftCharIndex(font->dpy, font->xfont, cp);
+	XftGlyphExtents(font->dpy, font->xfont, &glyph, 1, &ext);
+	if (cp < LENGTH(font->adv))
+		font->adv[cp] = ext.xOff + 1;
+	return ext.xOff;
+}
+
+static unsigned long
+xfont_mem(Fnt *font)
+{
+	int mem;
+
+	if (FcPatternGetInteger(font->xfont->pattern, XFT_MAX_GLYPH_MEMORY, 0, &mem) != FcResultMatch)
+		mem = GLYPHMEM;
+	return mem;
+}
+
+/* Moves font into a fallback slot. The clock hand gives fonts which were
+ * looked up since it last passed another round. If all of them were, they
+ * are on screen and none is evicted: returns NULL and keeps font. */
+static Fnt *
+fallback_add(Drw *drw, Fnt *font)
+{
+	Fnt *slot;
+	unsigned int gen;
+	size_t i;
+
+	for (i = 0; i < LENGTH(drw->fallback); i++) {
+		slot = &drw->fallback[drw->fbhand];
+		drw->fbhand = (drw->fbhand + 1) % LENGTH(drw->fallback);
+		if (!slot->xfont || !slot->used)
+			break;
+		slot->used = 0;
+	}
+	if (i == LENGTH(drw->fallback))
+		return NULL;
+	if (slot->xfont) {
+		drw->nfallback--;
+		drw->fallbackmem -= xfont_mem(slot);
+		XftFontClose(drw->dpy, slot->xfont);
+	}
+	gen = slot->gen + 1;
+	*slot = *font;
+	slot->gen = gen;
+	slot->used = 1;
+	free(font);
+	drw->nfallback++;
+	drw->fallbackmem += xfont_mem(slot);
+	return slot;
+}
+
+/* Asks fontconfig for a font with a glyph for cp in the background. */
+static void
+xfont_fallback(Drw *drw, long cp)
+{
+	FcCharSet *fccharset;
+	FcPattern *fcpattern;
+
+	if (!drw->fonts->pattern) {
+		/* Refer to the comment in xfont_create for more information. */
+		die("the first font in the cache must be loaded from a font string.");
+	}
+
+	fccharset = FcCharSetCreate();
+	FcCharSetAddChar(fccharset, cp);
+
+	fcpattern = FcPatternDuplicate(drw->fonts->pattern);
+	FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
+	FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
+
+	/* what XftFontMatch does, but FcFontMatch */
+	FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
+	XftDefaultSubstitute(drw->dpy, drw->screen, fcpattern);
+
+	FcCharSetDestroy(fccharset);
+	job_add(drw, fcpattern, NULL, cp);
+}
+
+/* Takes the font the worker found for a fallback search. Returns 1 if
+ * the codepoint is now drawn with it, -1 if all slots are in use. */
+static int
+xfont_fallback_done(Drw *drw, struct Job *j)
+{
+	Fnt *font = NULL, *slot;
+	Chr *c = chr_get(drw, j->cp);
+	size_t i;
+
+	if (!c || c->font != &pending)
+		return 0; /* the caches were dropped meanwhile */
+	if (j->match && (font = xfont_create(drw, NULL, j->match)))
+		j->match = NULL; /* owned by the font now */
+	if (!font || !XftCharExists(drw->dpy, font->xfont, j->cp)) {
+		xfont_free(font);
+		drw->nfmisses++;
+		chr_set(drw, j->cp, &nofont);
+		return 0;
+	}
+	/* fontconfig may well have matched a font which is open already */
+	for (i = 0; i < LENGTH(drw->fallback); i++)
+		if (drw->fallback[i].xfont == font->xfont) {
+			xfont_free(font);
+			drw->fallback[i].used = 1;
+			chr_set(drw, j->cp, &drw->fallback[i]);
+			return 1;
+		}
+	if (!(slot = fallback_add(drw, font))) {
+		/* left unresolved, drawing it later asks again */
+		xfont_free(font);
+		c->gen = ~pending.gen;
+		return -1;
+	}
+	chr_set(drw, j->cp, slot);
+	return 1;
+}
+
+/* Returns the first configured font which has a glyph for cp, else a
+ * fallback font, or NULL if there is none (yet). */
+static Fnt *
+xfont_lookup(Drw *drw, long cp)
+{
+	Chr *c = chr_get(drw, cp);
+	Fnt *font;
+	size_t i;
+
+	if (c && c->font && c->font->gen == c->gen) {
+		if (c->font == &nofont)
+			drw->nfhits++;
+		if (c->font == &nofont || c->font == &pending)
+			return NULL;
+		c->font->used = 1;
+		return c->font;
+	}
+
+	for (font = drw->fonts; font; font = font->next)
+		if (XftCharExists(drw->dpy, font->xfont, cp))
+			break;
+	/* a font found for another codepoint likely covers this one too */
+	for (i = 0; !font && i < LENGTH(drw->fallback); i++)
+		if (drw->fallback[i].xfont && XftCharExists(drw->dpy, drw->fallback[i].xfont, cp)) {
+			font = &drw->fallback[i];
+			font->used = 1;
+		}
+	if (!font && drw->fbjobs) {
+		/* its font likely covers this one too, look again after it */
+		drw->fbwaiting = 1;
+		return NULL;
+	}
+	if (!font) {
+		xfont_fallback(drw, cp);
+		drw->fbjobs++;
+		font = &pending;
+	}
+	chr_set(drw, cp, font);
+	return font == &pending ? NULL : font;
+}
+
 Fnt*
 drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 {
@@ -167,9 +639,84 @@ drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 			ret = cur;
 		}
 	}
+	cache_clear(drw);
 	return (drw->fonts = ret);
 }
 
+/* Loads the first font which can be loaded right away, the others are
+ * matched in the background and appended by drw_collect. */
+Fnt *
+drw_fontset_load(Drw *drw, const char *fonts[], size_t fontcount)
+{
+	FcPattern *pattern;
+	size_t i;
+
+	if (!drw || !fonts)
+		return NULL;
+
+	for (i = 0; i < fontcount; i++)
+		if ((drw->fonts = xfont_create(drw, fonts[i], NULL)))
+			break;
+	cache_clear(drw);
+	for (i++; i < fontcount; i++) {
+		if (!(pattern = FcNameParse((FcChar8 *) fonts[i]))) {
+			fprintf(stderr, "error, cannot parse font name to pattern: '%s'\n", fonts[i]);
+			continue;
+		}
+		/* what XftFontMatch does, but FcFontMatch */
+		FcConfigSubstitute(NULL, pattern, FcMatchPattern);
+		XftDefaultSubstitute(drw->dpy, drw->screen, pattern);
+		job_add(drw, pattern, fonts[i], -1);
+	}
+	return drw->fonts;
+}
+
+/* Takes the results of the worker when drw->workfd is readable. Returns 1
+ * if the fontset changed and text needs to be drawn again. */
+int
+drw_collect(Drw *drw)
+{
+	struct Job *j;
+	Fnt *font, **last;
+	int changed = 0, glyphs = 0, full = 0, r;
+
+	if (!drw || !drw->worker)
+		return 0;
+
+	while (read(drw->workfd, &j, sizeof j) == sizeof j) {
+		if (j->cp != -1) {
+			drw->fbjobs--;
+			if ((r = xfont_fallback_done(drw, j)) < 0)
+				full = 1;
+			else
+				glyphs |= r;
+			job_free(j);
+			continue;
+		}
+		if (!j->match || !(font = xfont_create(drw, NULL, j->match))) {
+			fprintf(stderr, "error, cannot load font from name: '%s'\n", j->name);
+			job_free(j);
+			continue;
+		}
+		j->match = NULL; /* owned by the font now */
+		for (last = &drw->fonts; *last; last = &(*last)->next)
+			;
+		*last = font;
+		changed = 1;
+		job_free(j);
+	}
+	if (!drw->fbjobs && drw->fbwaiting) {
+		drw->fbwaiting = 0;
+		/* to look them up again, unless they would find no free slot either */
+		glyphs |= !full;
+	}
+	if (changed)
+		cache_clear(drw);
+	else if (glyphs)
+		ext_clear(drw);
+	return changed || glyphs;
+}
+
 void
 drw_fontset_free(Fnt *font)
 {
@@ -211,8 +758,10 @@ drw_scm_create(Drw *drw, const char *clrnames[], size_t clrcount)
 void
 drw_setfontset(Drw *drw, Fnt *set)
 {
-	if (drw)
+	if (drw && drw->fonts != set) {
+		cache_clear(drw);
 		drw->fonts = set;
+	}
 }
 
 void
@@ -222,164 +771,343 @@ drw_setscheme(Drw *drw, Clr *scm)
 		drw->scheme = scm;
 }
 
+void
+drw_setbuf(Drw *drw, Buf *buf)
+{
+	if (drw)
+		drw->buf = buf;
+}
+
+#ifdef SHM
+static void
+shm_fill(Buf *b, int x, int y, unsigned int w, unsigned int h, unsigned long pixel)
+{
+	int i, j, x1 = MIN(x + (int)w, (int)b->w), y1 = MIN(y + (int)h, (int)b->h);
+	uint32_t *p;
+
+	for (j = MAX(y, 0); j < y1; j++)
+		for (p = ROW(b, j), i = MAX(x, 0); i < x1; i++)
+			p[i] = pixel;
+}
+
+static uint32_t
+shm_blend(uint32_t d, const Clr *c, unsigned int a)
+{
+	uint32_t r = ((d >> 16 & 0xff) * (255 - a) + (c->color.red >> 8) * a) / 255;
+	uint32_t g = ((d >> 8 & 0xff) * (255 - a) + (c->color.green >> 8) * a) / 255;
+	uint32_t b = ((d & 0xff) * (255 - a) + (c->color.blue >> 8) * a) / 255;
+
+	return (d & 0xff000000) | r << 16 | g << 8 | b;
+}
+
+/* coverage of a glyph, rendered by FreeType once */
+static Bmp *
+shm_glyph(Drw *drw, Fnt *font, FT_Face face, unsigned int glyph)
+{
+	Bmp *b = &drw->bmps[(glyph ^ (uintptr_t)font >> 4) & (LENGTH(drw->bmps) - 1)];
+	FT_Bitmap *bm;
+	FcBool aa = FcTrue;
+	unsigned int i, j;
+	unsigned char *row;
+
+	if (b->bits && b->font == font && b->gen == font->gen && b->glyph == glyph)
+		return b;
+	free(b->bits);
+	b->bits = NULL;
+
+	FcPatternGetBool(font->xfont->pattern, FC_ANTIALIAS, 0, &aa);
+	if (FT_Load_Glyph(face, glyph, FT_LOAD_RENDER | (aa ? 0 : FT_LOAD_TARGET_MONO)))
+		return NULL;
+	bm = &face->glyph->bitmap;
+	if (bm->pixel_mode != FT_PIXEL_MODE_GRAY && bm->pixel_mode != FT_PIXEL_MODE_MONO)
+		return NULL;
+	b->bits = ecalloc(bm->width * bm->rows + 1, 1);
+	for (j = 0; j < bm->rows; j++) {
+		row = bm->buffer + j * bm->pitch;
+		for (i = 0; i < bm->width; i++)
+			b->bits[j * bm->width + i] = bm->pixel_mode == FT_PIXEL_MODE_MONO
+				? (row[i / 8] >> (7 - i % 8) & 1) * 255 : row[i];
+	}
+	b->font = font;
+	b->gen = font->gen;
+	b->glyph = glyph;
+	b->left = face->glyph->bitmap_left;
+	b->top = face->glyph->bitmap_top;
+	b->w = bm->width;
+	b->rows = bm->rows;
+	return b;
+}
+
+static void
+shm_text(Drw *drw, Fnt *font, Clr *c, int x, int y, const char *text, size_t len)
+{
+	Buf *b = drw->buf;
+	FT_Face face;
+	Bmp *g;
+	long cp;
+	size_t n;
+	int i, j, gx, gy;
+	unsigned int a;
+	uint32_t *p;
+
+	if (!(face = XftLockFace(font->xfont)))
+		return;
+	for (; len && (n = utf8decode(text, &cp, MIN(len, UTF_SIZ))); text += n, len -= n) {
+		if ((g = shm_glyph(drw, font, face, XftCharIndex(drw->dpy, font->xfont, cp)))) {
+			gx = x + g->left;
+			gy = y - g->top;
+			for (j = MAX(0, -gy); j < (int)g->rows && gy + j < (int)b->h; j++)
+				for (p = ROW(b, gy + j), i = MAX(0, -gx); i < (int)g->w && gx + i < (int)b->w; i++)
+					if ((a = g->bits[j * g->w + i]))
+						p[gx + i] = a == 255 ? c->pixel : shm_blend(p[gx + i], c, a);
+		}
+		x += xfont_advance(font, cp);
+	}
+	XftUnlockFace(font->xfont);
+}
+#endif /* SHM */
+
+static void
+fill(Drw *drw, int x, int y, unsigned int w, unsigned int h, Clr *c)
+{
+#ifdef SHM
+	if (drw->buf->img) {
+		shm_fill(drw->buf, x, y, w, h, c->pixel);
+		return;
+	}
+#endif
+	XSetForeground(drw->dpy, drw->gc, c->pixel);
+	XFillRectangle(drw->dpy, drw->buf->drawable, drw->gc, x, y, w, h);
+}
+
+/* returns 0 if the buffers cannot be copied between */
+static int
+copyarea(Drw *drw, Buf *src, int sx, int sy, unsigned int w, unsigned int h, Buf *dst, int dx, int dy)
+{
+#ifdef SHM
+	unsigned int j;
+
+	if (src->img && dst->img) {
+		w = MIN(w, MIN(src->w - sx, dst->w - dx));
+		h = MIN(h, MIN(src->h - sy, dst->h - dy));
+		for (j = 0; j < h; j++)
+			memcpy(ROW(dst, dy + j) + dx, ROW(src, sy + j) + sx, w * sizeof(uint32_t));
+		return 1;
+	} else if (src->img || dst->img) {
+		return 0;
+	}
+#endif
+	XCopyArea(drw->dpy, src->drawable, dst->drawable, drw->gc, sx, sy, w, h, dx, dy);
+	return 1;
+}
+
 void
 drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int invert)
 {
-	if (!drw || !drw->scheme)
+	Clr *c;
+
+	if (!drw || !drw->scheme || !drw->buf)
 		return;
-	XSetForeground(drw->dpy, drw->gc, invert ? drw->scheme[ColBg].pixel : drw->scheme[ColFg].pixel);
-	if (filled)
-		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-	else
-		XDrawRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w - 1, h - 1);
+	c = &drw->scheme[invert ? ColBg : ColFg];
+	if (filled) {
+		fill(drw, x, y, w, h, c);
+#ifdef SHM
+	} else if (drw->buf->img) {
+		fill(drw, x, y, w, 1, c);
+		fill(drw, x, y + h - 1, w, 1, c);
+		fill(drw, x, y, 1, h, c);
+		fill(drw, x + w - 1, y, 1, h, c);
+#endif
+	} else {
+		XSetForeground(drw->dpy, drw->gc, c->pixel);
+		XDrawRectangle(drw->dpy, drw->buf->drawable, drw->gc, x, y, w - 1, h - 1);
+	}
 }
 
 int
 drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert)
 {
-	char buf[1024];
-	int ty;
-	unsigned int ew;
-	XftDraw *d = NULL;
+	int ty, ellipsis_x = 0;
+	unsigned int tmpw, ew, ellipsis_w = 0, ellipsis_len, ellipsis_width = 0;
 	Fnt *usedfont, *curfont, *nextfont;
-	size_t i, len;
 	int utf8strlen, utf8charlen, render = x || y || w || h;
 	long utf8codepoint = 0;
 	const char *utf8str;
-	FcCharSet *fccharset;
-	FcPattern *fcpattern;
-	FcPattern *match;
-	XftResult result;
-	int charexists = 0;
+	int overflow = 0;
+	Chr *c;
 
-	if (!drw || (render && !drw->scheme) || !text || !drw->fonts)
+	if (!drw || (render && (!drw->scheme || !drw->buf)) || !text || !drw->fonts)
 		return 0;
 
 	if (!render) {
 		w = ~w;
 	} else {
-		XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
-		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-		d = XftDrawCreate(drw->dpy, drw->drawable,
-		                  DefaultVisual(drw->dpy, drw->screen),
-		                  DefaultColormap(drw->dpy, drw->screen));
+		fill(drw, x, y, w, h, &drw->scheme[invert ? ColFg : ColBg]);
 		x += lpad;
 		w -= lpad;
+		ellipsis_width = drw_fontset_getwidth(drw, "...");
 	}
 
 	usedfont = drw->fonts;
 	while (1) {
-		utf8strlen = 0;
+		ew = ellipsis_len = utf8strlen = 0;
 		utf8str = text;
 		nextfont = NULL;
 		while (*text) {
-			utf8charlen = utf8decode(text, &utf8codepoint, UTF_SIZ);
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = charexists || XftCharExists(drw->dpy, curfont->xfont, utf8codepoint);
-				if (charexists) {
-					if (curfont == usedfont) {
-						utf8strlen += utf8charlen;
-						text += utf8charlen;
-					} else {
-						nextfont = curfont;
-					}
+			c = &drw->latin[(unsigned char)*text];
+			if (!(*text & 0x80) && c->font == usedfont && c->gen == usedfont->gen
+			&& usedfont->adv[(unsigned char)*text]) {
+				/* ASCII the current font is known to have */
+				utf8codepoint = *text;
+				utf8charlen = 1;
+				tmpw = usedfont->adv[utf8codepoint] - 1;
+			} else {
+				utf8charlen = utf8decode(text, &utf8codepoint, UTF_SIZ);
+				/* glyphs no font has are drawn with the first font */
+				if (!(curfont = xfont_lookup(drw, utf8codepoint)))
+					curfont = drw->fonts;
+				if (curfont != usedfont) {
+					nextfont = curfont;
 					break;
 				}
+				tmpw = xfont_advance(curfont, utf8codepoint);
 			}
-
-			if (!charexists || nextfont)
+			if (ew + ellipsis_width <= w) {
+				/* keep track where the ellipsis still fits */
+				ellipsis_x = x + ew;
+				ellipsis_w = w - ew;
+				ellipsis_len = utf8strlen;
+			}
+			if (ew + tmpw > w) {
+				overflow = 1;
+				if (ellipsis_w)
+					utf8strlen = ellipsis_len;
 				break;
-			else
-				charexists = 0;
+			}
+			utf8strlen += utf8charlen;
+			text += utf8charlen;
+			ew += tmpw;
 		}
 
-		if (utf8strlen) {
-			drw_font_getexts(usedfont, utf8str, utf8strlen, &ew, NULL);
-			/* shorten text if necessary */
-			for (len = MIN(utf8strlen, sizeof(buf) - 1); len && ew > w; len--)
-				drw_font_getexts(usedfont, utf8str, len, &ew, NULL);
-
-			if (len) {
-				memcpy(buf, utf8str, len);
-				buf[len] = '\0';
-				if (len < utf8strlen)
-					for (i = len; i && i > len - 3; buf[--i] = '.')
-						; /* NOP */
-
-				if (render) {
-					ty = y + (h - usedfont->h) / 2 + usedfont->xfont->ascent;
-					XftDrawStringUtf8(d, &drw->scheme[invert ? ColBg : ColFg],
-					                  usedfont->xfont, x, ty, (XftChar8 *)buf, len);
-				}
-				x += ew;
-				w -= ew;
-			}
+		if (utf8strlen && render) {
+			ty = y + (h - usedfont->h) / 2 + usedfont->xfont->ascent;
+#ifdef SHM
+			if (drw->buf->img)
+				shm_text(drw, usedfont, &drw->scheme[invert ? ColBg : ColFg],
+				         x, ty, utf8str, utf8strlen);
+			else
+#endif
+			XftDrawStringUtf8(drw->buf->xftdraw, &drw->scheme[invert ? ColBg : ColFg],
+			                  usedfont->xfont, x, ty, (XftChar8 *)utf8str, utf8strlen);
 		}
+		x += ew;
+		w -= ew;
 
-		if (!*text) {
+		if (overflow) {
+			if (ellipsis_w)
+				drw_text(drw, ellipsis_x, y, ellipsis_w, h, 0, "...", invert);
+			break;
+		} else if (!*text) {
 			break;
-		} else if (nextfont) {
-			charexists = 0;
-			usedfont = nextfont;
-		} else {
-			/* Regardless of whether or not a fallback font is found, the
-			 * character must be drawn. */
-			charexists = 1;
-
-			fccharset = FcCharSetCreate();
-			FcCharSetAddChar(fccharset, utf8codepoint);
-
-			if (!drw->fonts->pattern) {
-				/* Refer to the comment in xfont_create for more information. */
-				die("the first font in the cache must be loaded from a font string.");
-			}
-
-			fcpattern = FcPatternDuplicate(drw->fonts->pattern);
-			FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
-			FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
-
-			FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
-			FcDefaultSubstitute(fcpattern);
-			match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
-
-			FcCharSetDestroy(fccharset);
-			FcPatternDestroy(fcpattern);
-
-			if (match) {
-				usedfont = xfont_create(drw, NULL, match);
-				if (usedfont && XftCharExists(drw->dpy, usedfont->xfont, utf8codepoint)) {
-					for (curfont = drw->fonts; curfont->next; curfont = curfont->next)
-						; /* NOP */
-					curfont->next = usedfont;
-				} else {
-					xfont_free(usedfont);
-					usedfont = drw->fonts;
-				}
-			}
 		}
+		usedfont = nextfont;
 	}
-	if (d)
-		XftDrawDestroy(d);
 
 	return x + (render ? w : 0);
 }
 
+/* Copies the sprite drawn with text in state to the buffer, returns 0 if
+ * there is none of that size. */
+int
+drw_sprite_copy(Drw *drw, int x, int y, unsigned int w, unsigned int h, const char *text, unsigned int state)
+{
+	Sprite *s;
+	size_t i;
+
+	if (!drw || !drw->buf || !drw->atlas || drw->atlas->h != h)
+		return 0;
+
+	for (i = 0; i < drw->nsprites; i++) {
+		s = &drw->sprites[i];
+		if (s->w == w && s->state == state && !strcmp(s->text, text))
+			return copyarea(drw, drw->atlas, s->x, 0, w, h, drw->buf, x, y);
+	}
+	return 0;
+}
+
+/* Keeps what was drawn at x, y as the sprite of text in state. */
+void
+drw_sprite_save(Drw *drw, int x, int y, unsigned int w, unsigned int h, const char *text, unsigned int state)
+{
+	Sprite *s;
+
+	if (!drw || !drw->buf || strlen(text) >= sizeof s->text || w > ATLASW)
+		return;
+
+	if (!drw->atlas || drw->atlas->h != h) {
+		drw_buf_free(drw, drw->atlas);
+		drw->atlas = drw_buf_create(drw, ATLASW, h);
+		drw->nsprites = drw->atlasx = 0;
+	}
+	if (drw->nsprites == LENGTH(drw->sprites) || drw->atlasx + w > ATLASW)
+		drw->nsprites = drw->atlasx = 0; /* full, start over */
+	s = &drw->sprites[drw->nsprites++];
+	s->x = drw->atlasx;
+	s->w = w;
+	s->state = state;
+	strcpy(s->text, text);
+	if (!copyarea(drw, drw->buf, x, y, w, h, drw->atlas, s->x, 0)) {
+		drw->nsprites--;
+		return;
+	}
+	drw->atlasx += w;
+}
+
 void
 drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h)
 {
-	if (!drw)
+	if (!drw || !drw->buf)
 		return;
 
-	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
-	XSync(drw->dpy, False);
+#ifdef SHM
+	if (drw->buf->img)
+		XShmPutImage(drw->dpy, win, drw->gc, drw->buf->img, x, y, x, y, w, h, False);
+	else
+#endif
+	XCopyArea(drw->dpy, drw->buf->drawable, win, drw->gc, x, y, w, h, x, y);
+}
+
+/* Waits for what was mapped to be drawn, then the shared pixels can be
+ * drawn to again. */
+void
+drw_sync(Drw *drw)
+{
+	if (drw)
+		XSync(drw->dpy, False);
 }
 
 unsigned int
 drw_fontset_getwidth(Drw *drw, const char *text)
 {
+	Ext *e;
+	size_t len;
+	unsigned int h;
+
 	if (!drw || !drw->fonts || !text)
 		return 0;
-	return drw_text(drw, 0, 0, 0, 0, 0, text, 0);
+
+	/* direct-mapped: a colliding string evicts the previous entry */
+	h = strhash(text);
+	e = &drw->extcache[h & (LENGTH(drw->extcache) - 1)];
+	if (e->text && e->hash == h && !strcmp(e->text, text))
+		return e->w;
+
+	free(e->text);
+	len = strlen(text) + 1;
+	e->text = memcpy(ecalloc(len, 1), text, len);
+	e->hash = h;
+	e->w = drw_text(drw, 0, 0, 0, 0, 0, text, 0);
+	return e->w;
 }
 
 void
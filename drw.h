@@ -10,29 +10,94 @@ typedef struct Fnt {
 	XftFont *xfont;
 	FcPattern *pattern;
 	struct Fnt *next;
+	unsigned int gen; /* bumped whenever a fallback slot is reused */
+	int used;         /* looked up since the eviction hand last passed */
+	unsigned short adv[128]; /* ASCII advances plus one, 0 if not known yet */
 } Fnt;
 
 enum { ColFg, ColBg, ColBorder }; /* Clr scheme index */
 typedef XftColor Clr;
 
+typedef struct {
+	unsigned int hash, w;
+	char *text;
+} Ext;
+
+typedef struct {
+	long cp;
+	Fnt *font;
+	unsigned int gen; /* stale unless equal to font->gen */
+} Chr;
+
 typedef struct {
 	unsigned int w, h;
+	Drawable drawable;
+	XftDraw *xftdraw;
+#ifdef SHM
+	XImage *img;          /* pixels drawn by drw itself, or NULL */
+	XShmSegmentInfo shm;
+#endif
+} Buf;
+
+#ifdef SHM
+typedef struct {
+	Fnt *font;
+	unsigned int gen, glyph;
+	int left, top;        /* bitmap offset from the pen position */
+	unsigned int w, rows;
+	unsigned char *bits;  /* coverage, w bytes per row */
+} Bmp;
+#endif
+
+typedef struct {
+	int x;            /* position in the atlas */
+	unsigned int w, state;
+	char text[32];
+} Sprite;
+
+typedef struct {
 	Display *dpy;
 	int screen;
 	Window root;
-	Drawable drawable;
+	Buf *buf;
 	GC gc;
 	Clr *scheme;
 	Fnt *fonts;
+	Ext extcache[64]; /* text widths of the current fontset, power of two */
+	Chr latin[256];   /* font of each Latin-1 codepoint, filled lazily */
+	Chr *chars;       /* font of any other codepoint, open addressing */
+	size_t nchars, charsz;
+	Fnt fallback[32]; /* fonts found through fontconfig, clock eviction */
+	size_t fbhand;
+	unsigned int nfallback;    /* fallback fonts open */
+	unsigned long fallbackmem; /* glyph memory they may hold, in bytes */
+	unsigned long nfhits;      /* lookups answered by the cache of missing glyphs */
+	unsigned long nfmisses;    /* codepoints fontconfig found no font for */
+	unsigned int fbjobs;       /* fallback searches queued, at most one */
+	int fbwaiting;             /* codepoints wait for that search to finish */
+	Buf *atlas;        /* pixels of the sprites side by side */
+	Sprite sprites[64];
+	size_t nsprites;
+	int atlasx;        /* free space in the atlas starts here */
+#ifdef SHM
+	Bmp bmps[256];     /* rendered glyphs, direct-mapped */
+#endif
+	struct Worker *worker; /* matches fonts in the background */
+	int workfd;            /* readable when the worker is done with some, or -1 */
 } Drw;
 
 /* Drawable abstraction */
-Drw *drw_create(Display *dpy, int screen, Window win, unsigned int w, unsigned int h);
-void drw_resize(Drw *drw, unsigned int w, unsigned int h);
+Drw *drw_create(Display *dpy, int screen, Window win);
 void drw_free(Drw *drw);
 
+/* Buffer abstraction */
+Buf *drw_buf_create(Drw *drw, unsigned int w, unsigned int h);
+void drw_buf_free(Drw *drw, Buf *buf);
+
 /* Fnt abstraction */
 Fnt *drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount);
+Fnt *drw_fontset_load(Drw *drw, const char *fonts[], size_t fontcount);
+int drw_collect(Drw *drw);
 void drw_fontset_free(Fnt* set);
 unsigned int drw_fontset_getwidth(Drw *drw, const char *text);
 void drw_font_getexts(Fnt *font, const char *text, unsigned int len, unsigned int *w, unsigned int *h);
@@ -48,10 +113,16 @@ void drw_cur_free(Drw *drw, Cur *cursor);
 /* Drawing context manipulation */
 void drw_setfontset(Drw *drw, Fnt *set);
 void drw_setscheme(Drw *drw, Clr *scm);
+void drw_setbuf(Drw *drw, Buf *buf);
 
 /* Drawing functions */
 void drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int invert);
 int drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert);
 
+/* Sprite functions */
+int drw_sprite_copy(Drw *drw, int x, int y, unsigned int w, unsigned int h, const char *text, unsigned int state);
+void drw_sprite_save(Drw *drw, int x, int y, unsigned int w, unsigned int h, const char *text, unsigned int state);
+
 /* Map functions */
 void drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h);
+void drw_sync(Drw *drw);
@@ -21,13 +21,17 @@
  * To understand everything else, start reading main().
  */
 #include <errno.h>
+#include <fcntl.h>
 #include <locale.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <X11/cursorfont.h>
@@ -39,9 +43,14 @@
 #ifdef XINERAMA
 #include <X11/extensions/Xinerama.h>
 #endif /* XINERAMA */
+#ifdef SHM
+#include <X11/extensions/XShm.h>
+#endif /* SHM */
 #include <X11/Xft/Xft.h>
 
 #include "drw.h"
+#include "match.h"
+#include "status.h"
 #include "util.h"
 
 /* macros */
@@ -50,22 +59,24 @@
 #define INTERSECT(x,y,w,h,m)    (MAX(0, MIN((x)+(w),(m)->wx+(m)->ww) - MAX((x),(m)->wx)) \
                                * MAX(0, MIN((y)+(h),(m)->wy+(m)->wh) - MAX((y),(m)->wy)))
 #define ISVISIBLE(C)            ((C->tags & C->mon->tagset[C->mon->seltags]))
-#define LENGTH(X)               (sizeof X / sizeof X[0])
 #define MOUSEMASK               (BUTTONMASK|PointerMotionMask)
 #define WIDTH(X)                ((X)->w + 2 * (X)->bw)
 #define HEIGHT(X)               ((X)->h + 2 * (X)->bw)
 #define TAGMASK                 ((1 << LENGTH(tags)) - 1)
 #define TEXTW(X)                (drw_fontset_getwidth(drw, (X)) + lrpad)
+#define TAGSEG(I)               (SegTags + (I))
+#define STATUSSEG(I)            (SegTags + LENGTH(tags) + (I))
 
 /* enums */
 enum { CurNormal, CurResize, CurMove, CurLast }; /* cursor */
 enum { SchemeNorm, SchemeSel }; /* color schemes */
 enum { NetSupported, NetWMName, NetWMState, NetWMCheck,
        NetWMFullscreen, NetActiveWindow, NetWMWindowType,
-       NetWMWindowTypeDialog, NetClientList, NetLast }; /* EWMH atoms */
+       NetWMWindowTypeDialog, NetClientList, NetClientListStacking, NetLast }; /* EWMH atoms */
 enum { WMProtocols, WMDelete, WMState, WMTakeFocus, WMLast }; /* default atoms */
 enum { ClkTagBar, ClkLtSymbol, ClkStatusText, ClkWinTitle,
        ClkClientWin, ClkRootWin, ClkLast }; /* clicks */
+enum { SegLtSymbol, SegWinTitle, SegTags }; /* bar segments */
 
 typedef union {
 	int i;
@@ -93,6 +104,12 @@ struct Client {
 	int bw, oldbw;
 	unsigned int tags;
 	int isfixed, isfloating, isurgent, neverfocus, oldstate, isfullscreen;
+	int titledirty;                 /* name changed since it was fetched */
+	int grabs;                      /* buttons grabbed for: 0 nothing, 1 unfocused, 2 focused */
+	int hashints;
+	XWMHints hints;                 /* WM_HINTS as of the last PropertyNotify */
+	long long managed, titletime;   /* when managed, when name was fetched */
+	unsigned long ntitle, nfetch;   /* title changes notified, names fetched */
 	Client *next;
 	Client *snext;
 	Monitor *mon;
@@ -111,6 +128,12 @@ typedef struct {
 	void (*arrange)(Monitor *);
 } Layout;
 
+typedef struct {
+	int x, w;
+	unsigned int state;
+	char text[256];
+} Seg;
+
 struct Monitor {
 	char ltsymbol[16];
 	float mfact;
@@ -129,6 +152,8 @@ struct Monitor {
 	Client *stack;
 	Monitor *next;
 	Window barwin;
+	Buf *buf;             /* bar contents, kept for exposes */
+	Seg *seg;             /* what buf shows where, followed by tags and status blocks */
 	const Layout *lt[2];
 };
 
@@ -141,7 +166,15 @@ typedef struct {
 	int monitor;
 } Rule;
 
+typedef struct {
+	const char *(*func)(const char *arg);
+	const char *fmt;
+	const char *arg;
+	int interval; /* ms */
+} Module;
+
 /* function declarations */
+static void addspan(int *span, unsigned int *n, int x, int w);
 static void applyrules(Client *c);
 static int applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact);
 static void arrange(Monitor *m);
@@ -153,6 +186,7 @@ static void checkotherwm(void);
 static void cleanup(void);
 static void cleanupmon(Monitor *mon);
 static void clientmessage(XEvent *e);
+static void compilerules(void);
 static void configure(Client *c);
 static void configurenotify(XEvent *e);
 static void configurerequest(XEvent *e);
@@ -163,8 +197,11 @@ static void detachstack(Client *c);
 static Monitor *dirtomon(int dir);
 static void drawbar(Monitor *m);
 static void drawbars(void);
+static int drawseg(Seg *s, int x, int w, unsigned int state, const char *text);
 static void enternotify(XEvent *e);
 static void expose(XEvent *e);
+static void fetchtitle(Client *c, long long now);
+static long long fetchtitles(long long now);
 static void focus(Client *c);
 static void focusin(XEvent *e);
 static void focusmon(const Arg *arg);
@@ -183,17 +220,23 @@ static void maprequest(XEvent *e);
 static void monocle(Monitor *m);
 static void motionnotify(XEvent *e);
 static void movemouse(const Arg *arg);
+static long long mstime(void);
 static Client *nexttiled(Client *c);
+static void parsestatus(const char *text);
 static void pop(Client *);
 static void propertynotify(XEvent *e);
 static void quit(const Arg *arg);
+static void readstatus(void);
 static Monitor *recttomon(int x, int y, int w, int h);
 static void resize(Client *c, int x, int y, int w, int h, int interact);
 static void resizeclient(Client *c, int x, int y, int w, int h);
 static void resizemouse(const Arg *arg);
 static void restack(Monitor *m);
+static void rulehit(int i, void *unused);
 static void run(void);
+static int runmodule(unsigned int i);
 static void scan(void);
+static int segat(Monitor *m, int first, int n, int x);
 static int sendevent(Client *c, Atom proto);
 static void sendmon(Client *c, Monitor *m);
 static void setclientstate(Client *c, long state);
@@ -201,11 +244,15 @@ static void setfocus(Client *c);
 static void setfullscreen(Client *c, int fullscreen);
 static void setlayout(const Arg *arg);
 static void setmfact(const Arg *arg);
+static void setstatus(void);
 static void setup(void);
 static void seturgent(Client *c, int urg);
 static void showhide(Client *c);
 static void sigchld(int unused);
+static void sigusr1(int unused);
 static void spawn(const Arg *arg);
+static void startupmark(const char *phase);
+static void stats(void);
 static void tag(const Arg *arg);
 static void tagmon(const Arg *arg);
 static void tile(Monitor *);
@@ -218,14 +265,16 @@ static void unmanage(Client *c, int destroyed);
 static void unmapnotify(XEvent *e);
 static void updatebarpos(Monitor *m);
 static void updatebars(void);
+static void updatebindings(void);
 static void updateclientlist(void);
 static int updategeom(void);
 static void updatenumlockmask(void);
 static void updatesizehints(Client *c);
+static void updatestacking(void);
 static void updatestatus(void);
 static void updatetitle(Client *c);
 static void updatewindowtype(Client *c);
-static void updatewmhints(Client *c);
+static int updatewmhints(Client *c);
 static void view(const Arg *arg);
 static Client *wintoclient(Window w);
 static Monitor *wintomon(Window w);
@@ -236,10 +285,18 @@ static void zoom(const Arg *arg);
 
 /* variables */
 static const char broken[] = "broken";
-static char stext[256];
+static char stext[16][256];  /* status blocks, each as long as the status used to be */
+static char snext[LENGTH(stext)][sizeof stext[0]]; /* status blocks to show */
+static int sfifofd = -1, sfifopending = 0;
+static int titlesdirty = 0;  /* some client's name needs to be fetched */
+static Window *clientlist;   /* _NET_CLIENT_LIST, in order of mapping */
+static Window *stacklist;    /* _NET_CLIENT_LIST_STACKING as last set */
+static int nclients = 0, nstacklist = 0, clientsz = 0;
+static volatile sig_atomic_t dumpstats = 0;
+static long long sfifotime;  /* when a line from statusfifo was last shown */
 static int screen;
 static int sw, sh;           /* X display screen geometry width, height */
-static int bh, blw = 0;      /* bar geometry */
+static int bh;               /* bar geometry */
 static int lrpad;            /* sum of left and right padding for text */
 static int (*xerrorxlib)(Display *, XErrorEvent *);
 static unsigned int numlockmask = 0;
@@ -260,6 +317,24 @@ static void (*handler[LASTEvent]) (XEvent *) = {
 	[UnmapNotify] = unmapnotify
 };
 static Atom wmatom[WMLast], netatom[NetLast];
+static const char *wmatomnames[WMLast] = {
+	[WMProtocols] = "WM_PROTOCOLS",
+	[WMDelete] = "WM_DELETE_WINDOW",
+	[WMState] = "WM_STATE",
+	[WMTakeFocus] = "WM_TAKE_FOCUS",
+};
+static const char *netatomnames[NetLast] = {
+	[NetActiveWindow] = "_NET_ACTIVE_WINDOW",
+	[NetSupported] = "_NET_SUPPORTED",
+	[NetWMName] = "_NET_WM_NAME",
+	[NetWMState] = "_NET_WM_STATE",
+	[NetWMCheck] = "_NET_SUPPORTING_WM_CHECK",
+	[NetWMFullscreen] = "_NET_WM_STATE_FULLSCREEN",
+	[NetWMWindowType] = "_NET_WM_WINDOW_TYPE",
+	[NetWMWindowTypeDialog] = "_NET_WM_WINDOW_TYPE_DIALOG",
+	[NetClientList] = "_NET_CLIENT_LIST",
+	[NetClientListStacking] = "_NET_CLIENT_LIST_STACKING",
+};
 static int running = 1;
 static Cur *cursor[CurLast];
 static Clr **scheme;
@@ -274,12 +349,47 @@ static Window root, wmcheckwin;
 /* compile-time check if all tags fit into an unsigned int bit array. */
 struct NumTags { char limitexceeded[LENGTH(tags) > 31 ? -1 : 1]; };
 
+/* compile-time check if there is a status block for every module. */
+struct NumModules { char limitexceeded[LENGTH(modules) > LENGTH(stext) ? -1 : 1]; };
+
+static long long modnext[LENGTH(modules)]; /* when modules are run next */
+static unsigned int nmodules; /* modules with a function, each has a block */
+static Matcher *rulematch[3]; /* class, instance and title patterns of rules */
+static struct {
+	unsigned int need; /* patterns of the rule */
+	unsigned int got; /* of them found in the window at hand */
+	unsigned long run; /* applyrules() call got belongs to */
+	unsigned long nmatch; /* windows matched */
+} rulestate[LENGTH(rules)];
+static unsigned int rulehits[LENGTH(rules)]; /* rules matching the window at hand */
+static unsigned int nrulehits;
+static unsigned long rulerun;
+static const Key **keyidx; /* keys by keycode, see keystart */
+static unsigned int keystart[256 + 1]; /* keyidx[keystart[k]..keystart[k + 1]] match keycode k */
+static const Button *buttonidx[LENGTH(buttons)]; /* buttons by click, see buttonstart */
+static unsigned int buttonstart[ClkLast + 1];
+
 /* function implementations */
+/* Adds x..x + w to the spans of the bar to copy, merged with the last one
+ * if they are adjacent. */
+void
+addspan(int *span, unsigned int *n, int x, int w)
+{
+	if (*n && span[2 * *n - 1] == x) {
+		span[2 * *n - 1] = x + w;
+		return;
+	}
+	span[2 * *n] = x;
+	span[2 * *n + 1] = x + w;
+	(*n)++;
+}
+
 void
 applyrules(Client *c)
 {
 	const char *class, *instance;
-	unsigned int i;
+	unsigned int i, j, n;
+	int mon = -1;
 	const Rule *r;
 	Monitor *m;
 	XClassHint ch = { NULL, NULL };
@@ -291,18 +401,30 @@ applyrules(Client *c)
 	class    = ch.res_class ? ch.res_class : broken;
 	instance = ch.res_name  ? ch.res_name  : broken;
 
-	for (i = 0; i < LENGTH(rules); i++) {
-		r = &rules[i];
-		if ((!r->title || strstr(c->name, r->title))
-		&& (!r->class || strstr(class, r->class))
-		&& (!r->instance || strstr(instance, r->instance)))
-		{
-			c->isfloating = r->isfloating;
-			c->tags |= r->tags;
-			for (m = mons; m && m->num != r->monitor; m = m->next);
-			if (m)
-				c->mon = m;
+	rulerun++;
+	nrulehits = 0;
+	matcher_run(rulematch[0], class, rulehit, NULL);
+	matcher_run(rulematch[1], instance, rulehit, NULL);
+	matcher_run(rulematch[2], c->name, rulehit, NULL);
+	/* rules apply in the order of the config */
+	for (i = 1; i < nrulehits; i++)
+		for (j = i; j > 0 && rulehits[j - 1] > rulehits[j]; j--) {
+			n = rulehits[j];
+			rulehits[j] = rulehits[j - 1];
+			rulehits[j - 1] = n;
 		}
+	for (n = 0, m = mons; m; m = m->next, n++);
+	for (i = 0; i < nrulehits; i++) {
+		r = &rules[rulehits[i]];
+		rulestate[rulehits[i]].nmatch++;
+		c->isfloating = r->isfloating;
+		c->tags |= r->tags;
+		if (r->monitor >= 0 && (unsigned int)r->monitor < n)
+			mon = r->monitor;
+	}
+	if (mon != -1) {
+		for (m = mons; m->num != mon; m = m->next);
+		c->mon = m;
 	}
 	if (ch.res_class)
 		XFree(ch.res_class);
@@ -416,10 +538,12 @@ attachstack(Client *c)
 void
 buttonpress(XEvent *e)
 {
-	unsigned int i, x, click;
+	unsigned int i, click;
+	int n;
 	Arg arg = {0};
 	Client *c;
 	Monitor *m;
+	const Button *b;
 	XButtonPressedEvent *ev = &e->xbutton;
 
 	click = ClkRootWin;
@@ -430,18 +554,16 @@ buttonpress(XEvent *e)
 		focus(NULL);
 	}
 	if (ev->window == selmon->barwin) {
-		i = x = 0;
-		do
-			x += TEXTW(tags[i]);
-		while (ev->x >= x && ++i < LENGTH(tags));
-		if (i < LENGTH(tags)) {
+		/* tags are drawn over the status text */
+		if ((n = segat(selmon, TAGSEG(0), LENGTH(tags), ev->x)) != -1) {
 			click = ClkTagBar;
-			arg.ui = 1 << i;
-		} else if (ev->x < x + blw)
+			arg.ui = 1 << n;
+		} else if (segat(selmon, SegLtSymbol, 1, ev->x) != -1)
 			click = ClkLtSymbol;
-		else if (ev->x > selmon->ww - TEXTW(stext))
+		else if ((n = segat(selmon, STATUSSEG(0), LENGTH(stext), ev->x)) != -1) {
 			click = ClkStatusText;
-		else
+			arg.i = n;
+		} else
 			click = ClkWinTitle;
 	} else if ((c = wintoclient(ev->window))) {
 		focus(c);
@@ -449,10 +571,13 @@ buttonpress(XEvent *e)
 		XAllowEvents(dpy, ReplayPointer, CurrentTime);
 		click = ClkClientWin;
 	}
-	for (i = 0; i < LENGTH(buttons); i++)
-		if (click == buttons[i].click && buttons[i].func && buttons[i].button == ev->button
-		&& CLEANMASK(buttons[i].mask) == CLEANMASK(ev->state))
-			buttons[i].func(click == ClkTagBar && buttons[i].arg.i == 0 ? &arg : &buttons[i].arg);
+	for (i = buttonstart[click]; i < buttonstart[click + 1]; i++) {
+		b = buttonidx[i];
+		if (b->func && b->button == ev->button
+		&& CLEANMASK(b->mask) == CLEANMASK(ev->state))
+			b->func((click == ClkTagBar || click == ClkStatusText)
+				&& b->arg.i == 0 ? &arg : &b->arg);
+	}
 }
 
 void
@@ -487,7 +612,14 @@ cleanup(void)
 	for (i = 0; i < LENGTH(colors); i++)
 		free(scheme[i]);
 	XDestroyWindow(dpy, wmcheckwin);
+	if (sfifofd != -1)
+		close(sfifofd);
 	drw_free(drw);
+	free(clientlist);
+	free(stacklist);
+	free(keyidx);
+	for (i = 0; i < LENGTH(rulematch); i++)
+		matcher_free(rulematch[i]);
 	XSync(dpy, False);
 	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
 	XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
@@ -506,6 +638,8 @@ cleanupmon(Monitor *mon)
 	}
 	XUnmapWindow(dpy, mon->barwin);
 	XDestroyWindow(dpy, mon->barwin);
+	drw_buf_free(drw, mon->buf);
+	free(mon->seg);
 	free(mon);
 }
 
@@ -523,9 +657,38 @@ clientmessage(XEvent *e)
 			setfullscreen(c, (cme->data.l[0] == 1 /* _NET_WM_STATE_ADD    */
 				|| (cme->data.l[0] == 2 /* _NET_WM_STATE_TOGGLE */ && !c->isfullscreen)));
 	} else if (cme->message_type == netatom[NetActiveWindow]) {
-		if (c != selmon->sel && !c->isurgent)
+		if (c != selmon->sel && !c->isurgent) {
 			seturgent(c, 1);
+			drawbar(c->mon);
+		}
+	}
+}
+
+void
+compilerules(void)
+{
+	unsigned int i, j;
+	const char *pattern;
+
+	for (j = 0; j < LENGTH(rulematch); j++)
+		rulematch[j] = matcher_create();
+	for (i = 0; i < LENGTH(rules); i++) {
+		for (j = 0; j < LENGTH(rulematch); j++) {
+			pattern = j == 0 ? rules[i].class : j == 1 ? rules[i].instance : rules[i].title;
+			if (!pattern)
+				continue;
+			if (matcher_add(rulematch[j], pattern, i) < 0)
+				die("dwm: invalid rule pattern '%s'", pattern);
+			rulestate[i].need++;
+		}
+		/* a rule without patterns matches every window */
+		if (!rulestate[i].need) {
+			matcher_add(rulematch[0], "", i);
+			rulestate[i].need++;
+		}
 	}
+	for (j = 0; j < LENGTH(rulematch); j++)
+		matcher_compile(rulematch[j]);
 }
 
 void
@@ -561,7 +724,6 @@ configurenotify(XEvent *e)
 		sw = ev->width;
 		sh = ev->height;
 		if (updategeom() || dirty) {
-			drw_resize(drw, sw, bh);
 			updatebars();
 			for (m = mons; m; m = m->next) {
 				for (c = m->clients; c; c = c->next)
@@ -640,6 +802,7 @@ createmon(void)
 	m->topbar = topbar;
 	m->lt[0] = &layouts[0];
 	m->lt[1] = &layouts[1 % LENGTH(layouts)];
+	m->seg = ecalloc(STATUSSEG(LENGTH(stext)), sizeof(Seg));
 	strncpy(m->ltsymbol, layouts[0].symbol, sizeof m->ltsymbol);
 	return m;
 }
@@ -695,17 +858,44 @@ dirtomon(int dir)
 void
 drawbar(Monitor *m)
 {
-	int x, w, sw = 0;
+	int x, w, sw = 0, span[2 * STATUSSEG(LENGTH(stext))];
 	int boxs = drw->fonts->h / 9;
 	int boxw = drw->fonts->h / 6 + 2;
-	unsigned int i, occ = 0, urg = 0;
+	unsigned int i, last = 0, occ = 0, urg = 0, state, stdirty = 0, nspan = 0;
 	Client *c;
+	Seg *s;
 
+	if ((c = m->sel) && c->titledirty) {
+		if (c->titletime + titledelay <= mstime())
+			fetchtitle(c, mstime());
+		else
+			titlesdirty = 1; /* left to run() */
+	}
+	drw_setbuf(drw, m->buf);
 	/* draw status first so it can be overdrawn by tags later */
 	if (m == selmon) { /* status is only drawn on selected monitor */
-		drw_setscheme(drw, scheme[SchemeNorm]);
-		sw = TEXTW(stext) - lrpad + 2; /* 2px right padding */
-		drw_text(drw, m->ww - sw, 0, sw, bh, 0, stext, 0);
+		for (i = 0; i < LENGTH(stext); i++)
+			if (*stext[i]) {
+				sw += TEXTW(stext[i]) - lrpad;
+				last = i;
+			}
+		if (sw)
+			sw += 2; /* 2px right padding */
+	}
+	/* blocks are right-aligned, a block only moves those before it */
+	x = m->ww - sw;
+	for (i = 0; i < LENGTH(stext); i++) {
+		w = sw && *stext[i] ? TEXTW(stext[i]) - lrpad + (i == last ? 2 : 0) : 0;
+		s = &m->seg[STATUSSEG(i)];
+		if (drawseg(s, x, w, 0, w ? stext[i] : "")) {
+			stdirty = 1;
+			if (w) {
+				drw_setscheme(drw, scheme[SchemeNorm]);
+				drw_text(drw, x, 0, w, bh, 0, stext[i], 0);
+				addspan(span, &nspan, x, w);
+			}
+		}
+		x += w;
 	}
 
 	for (c = m->clients; c; c = c->next) {
@@ -716,20 +906,43 @@ drawbar(Monitor *m)
 	x = 0;
 	for (i = 0; i < LENGTH(tags); i++) {
 		w = TEXTW(tags[i]);
-		drw_setscheme(drw, scheme[m->tagset[m->seltags] & 1 << i ? SchemeSel : SchemeNorm]);
-		drw_text(drw, x, 0, w, bh, lrpad / 2, tags[i], urg & 1 << i);
-		if (occ & 1 << i)
-			drw_rect(drw, x + boxs, boxs, boxw, boxw,
-				m == selmon && selmon->sel && selmon->sel->tags & 1 << i,
-				urg & 1 << i);
+		state = (m->tagset[m->seltags] & 1 << i ? 1 : 0)
+		      | (urg & 1 << i ? 2 : 0)
+		      | (occ & 1 << i ? 4 : 0)
+		      | (m == selmon && selmon->sel && selmon->sel->tags & 1 << i ? 8 : 0);
+		s = &m->seg[TAGSEG(i)];
+		if (drawseg(s, x, w, state, tags[i]) || (stdirty && x + w > m->ww - sw)) {
+			/* state tells everything about the label, reuse its pixels */
+			if (!drw_sprite_copy(drw, x, 0, w, bh, tags[i], state)) {
+				drw_setscheme(drw, scheme[m->tagset[m->seltags] & 1 << i ? SchemeSel : SchemeNorm]);
+				drw_text(drw, x, 0, w, bh, lrpad / 2, tags[i], urg & 1 << i);
+				if (occ & 1 << i)
+					drw_rect(drw, x + boxs, boxs, boxw, boxw,
+						m == selmon && selmon->sel && selmon->sel->tags & 1 << i,
+						urg & 1 << i);
+				drw_sprite_save(drw, x, 0, w, bh, tags[i], state);
+			}
+			addspan(span, &nspan, x, w);
+		}
 		x += w;
 	}
-	w = blw = TEXTW(m->ltsymbol);
-	drw_setscheme(drw, scheme[SchemeNorm]);
-	x = drw_text(drw, x, 0, w, bh, lrpad / 2, m->ltsymbol, 0);
+	w = TEXTW(m->ltsymbol);
+	s = &m->seg[SegLtSymbol];
+	if (drawseg(s, x, w, 0, m->ltsymbol) || (stdirty && x + w > m->ww - sw)) {
+		/* state 1 << 4 is unlike any tag state */
+		if (!drw_sprite_copy(drw, x, 0, w, bh, m->ltsymbol, 1 << 4)) {
+			drw_setscheme(drw, scheme[SchemeNorm]);
+			drw_text(drw, x, 0, w, bh, lrpad / 2, m->ltsymbol, 0);
+			drw_sprite_save(drw, x, 0, w, bh, m->ltsymbol, 1 << 4);
+		}
+		addspan(span, &nspan, x, w);
+	}
+	x += w;
 
-	if ((w = m->ww - sw - x) > bh) {
-		if (m->sel) {
+	w = m->ww - sw - x;
+	state = m->sel ? 1 | m->sel->isfloating << 1 | m->sel->isfixed << 2 | (m == selmon) << 3 : 0;
+	if (drawseg(&m->seg[SegWinTitle], x, w, state, m->sel ? m->sel->name : "") && w > 0) {
+		if (m->sel && w > bh) {
 			drw_setscheme(drw, scheme[m == selmon ? SchemeSel : SchemeNorm]);
 			drw_text(drw, x, 0, w, bh, lrpad / 2, m->sel->name, 0);
 			if (m->sel->isfloating)
@@ -738,8 +951,13 @@ drawbar(Monitor *m)
 			drw_setscheme(drw, scheme[SchemeNorm]);
 			drw_rect(drw, x, 0, w, bh, 1, 1);
 		}
+		addspan(span, &nspan, x, w);
 	}
-	drw_map(drw, m->barwin, 0, 0, m->ww, bh);
+	/* copy the changed segments only */
+	for (i = 0; i < nspan; i++)
+		drw_map(drw, m->barwin, span[2 * i], 0, span[2 * i + 1] - span[2 * i], bh);
+	if (nspan)
+		drw_sync(drw);
 }
 
 void
@@ -751,6 +969,20 @@ drawbars(void)
 		drawbar(m);
 }
 
+/* Remembers what a bar segment shows. Returns 1 if it has changed and
+ * needs to be drawn. */
+int
+drawseg(Seg *s, int x, int w, unsigned int state, const char *text)
+{
+	if (s->x == x && s->w == w && s->state == state && !strcmp(s->text, text))
+		return 0;
+	s->x = x;
+	s->w = w;
+	s->state = state;
+	strncpy(s->text, text, sizeof s->text - 1);
+	return 1;
+}
+
 void
 enternotify(XEvent *e)
 {
@@ -776,8 +1008,46 @@ expose(XEvent *e)
 	Monitor *m;
 	XExposeEvent *ev = &e->xexpose;
 
-	if (ev->count == 0 && (m = wintomon(ev->window)))
+	/* the bar buffer is always up to date, no need to redraw */
+	if ((m = wintomon(ev->window)) && ev->window == m->barwin) {
+		drw_setbuf(drw, m->buf);
+		drw_map(drw, m->barwin, ev->x, ev->y, ev->width, ev->height);
+		drw_sync(drw);
+	}
+}
+
+void
+fetchtitle(Client *c, long long now)
+{
+	c->titledirty = 0;
+	c->titletime = now;
+	c->nfetch++;
+	updatetitle(c);
+}
+
+/* Fetches the changed names of the selected clients, each at most every
+ * titledelay ms. Other names are fetched once they are shown. Returns the
+ * ms until the next one is due, or -1. */
+long long
+fetchtitles(long long now)
+{
+	Client *c;
+	Monitor *m;
+	long long due, next = -1;
+
+	for (m = mons; m; m = m->next) {
+		if (!(c = m->sel) || !c->titledirty)
+			continue;
+		if ((due = c->titletime + titledelay) > now) {
+			if (next == -1 || due - now < next)
+				next = due - now;
+			continue;
+		}
+		fetchtitle(c, now);
 		drawbar(m);
+	}
+	titlesdirty = next != -1;
+	return next;
 }
 
 void
@@ -927,7 +1197,9 @@ gettextprop(Window w, Atom atom, char *text, unsigned int size)
 void
 grabbuttons(Client *c, int focused)
 {
-	updatenumlockmask();
+	if (c->grabs == focused + 1)
+		return;
+	c->grabs = focused + 1;
 	{
 		unsigned int i, j;
 		unsigned int modifiers[] = { 0, LockMask, numlockmask, numlockmask|LockMask };
@@ -935,30 +1207,27 @@ grabbuttons(Client *c, int focused)
 		if (!focused)
 			XGrabButton(dpy, AnyButton, AnyModifier, c->win, False,
 				BUTTONMASK, GrabModeSync, GrabModeSync, None, None);
-		for (i = 0; i < LENGTH(buttons); i++)
-			if (buttons[i].click == ClkClientWin)
-				for (j = 0; j < LENGTH(modifiers); j++)
-					XGrabButton(dpy, buttons[i].button,
-						buttons[i].mask | modifiers[j],
-						c->win, False, BUTTONMASK,
-						GrabModeAsync, GrabModeSync, None, None);
+		for (i = buttonstart[ClkClientWin]; i < buttonstart[ClkClientWin + 1]; i++)
+			for (j = 0; j < LENGTH(modifiers); j++)
+				XGrabButton(dpy, buttonidx[i]->button,
+					buttonidx[i]->mask | modifiers[j],
+					c->win, False, BUTTONMASK,
+					GrabModeAsync, GrabModeSync, None, None);
 	}
 }
 
 void
 grabkeys(void)
 {
-	updatenumlockmask();
 	{
-		unsigned int i, j;
+		unsigned int i, j, k;
 		unsigned int modifiers[] = { 0, LockMask, numlockmask, numlockmask|LockMask };
-		KeyCode code;
 
 		XUngrabKey(dpy, AnyKey, AnyModifier, root);
-		for (i = 0; i < LENGTH(keys); i++)
-			if ((code = XKeysymToKeycode(dpy, keys[i].keysym)))
+		for (k = 0; k < 256; k++)
+			for (i = keystart[k]; i < keystart[k + 1]; i++)
 				for (j = 0; j < LENGTH(modifiers); j++)
-					XGrabKey(dpy, code, keys[i].mod | modifiers[j], root,
+					XGrabKey(dpy, k, keyidx[i]->mod | modifiers[j], root,
 						True, GrabModeAsync, GrabModeAsync);
 	}
 }
@@ -985,17 +1254,15 @@ isuniquegeom(XineramaScreenInfo *unique, size_t n, XineramaScreenInfo *info)
 void
 keypress(XEvent *e)
 {
-	unsigned int i;
-	KeySym keysym;
+	unsigned int i, code;
 	XKeyEvent *ev;
 
 	ev = &e->xkey;
-	keysym = XKeycodeToKeysym(dpy, (KeyCode)ev->keycode, 0);
-	for (i = 0; i < LENGTH(keys); i++)
-		if (keysym == keys[i].keysym
-		&& CLEANMASK(keys[i].mod) == CLEANMASK(ev->state)
-		&& keys[i].func)
-			keys[i].func(&(keys[i].arg));
+	code = ev->keycode & 0xff;
+	for (i = keystart[code]; i < keystart[code + 1]; i++)
+		if (CLEANMASK(keyidx[i]->mod) == CLEANMASK(ev->state)
+		&& keyidx[i]->func)
+			keyidx[i]->func(&keyidx[i]->arg);
 }
 
 void
@@ -1022,6 +1289,7 @@ manage(Window w, XWindowAttributes *wa)
 	XWindowChanges wc;
 
 	c = ecalloc(1, sizeof(Client));
+	c->managed = c->titletime = mstime();
 	c->win = w;
 	/* geometry */
 	c->x = c->oldx = wa->x;
@@ -1064,8 +1332,14 @@ manage(Window w, XWindowAttributes *wa)
 		XRaiseWindow(dpy, c->win);
 	attach(c);
 	attachstack(c);
-	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend,
-		(unsigned char *) &(c->win), 1);
+	if (nclients == clientsz) {
+		clientsz = clientsz ? clientsz * 2 : 64;
+		if (!(clientlist = realloc(clientlist, clientsz * sizeof(Window)))
+		|| !(stacklist = realloc(stacklist, clientsz * sizeof(Window))))
+			die("realloc:");
+	}
+	clientlist[nclients++] = c->win;
+	updateclientlist();
 	XMoveResizeWindow(dpy, c->win, c->x + 2 * sw, c->y, c->w, c->h); /* some windows require this */
 	setclientstate(c, NormalState);
 	if (c->mon == selmon)
@@ -1079,11 +1353,24 @@ manage(Window w, XWindowAttributes *wa)
 void
 mappingnotify(XEvent *e)
 {
+	Client *c;
+	Monitor *m;
+	unsigned int oldmask = numlockmask;
 	XMappingEvent *ev = &e->xmapping;
 
 	XRefreshKeyboardMapping(ev);
-	if (ev->request == MappingKeyboard)
-		grabkeys();
+	if (ev->request != MappingKeyboard && ev->request != MappingModifier)
+		return;
+	updatenumlockmask();
+	updatebindings();
+	grabkeys();
+	if (numlockmask == oldmask)
+		return;
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next) {
+			c->grabs = 0;
+			grabbuttons(c, c == selmon->sel);
+		}
 }
 
 void
@@ -1192,6 +1479,15 @@ movemouse(const Arg *arg)
 	}
 }
 
+long long
+mstime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
 Client *
 nexttiled(Client *c)
 {
@@ -1199,6 +1495,33 @@ nexttiled(Client *c)
 	return c;
 }
 
+/* Parses status text into the pending blocks. Blocks are separated by
+ * tabs, text of the form "\tN\ttext" only sets block N. The last blocks
+ * belong to the modules. */
+void
+parsestatus(const char *text)
+{
+	unsigned long i;
+	size_t n;
+	char *end;
+
+	if (*text == '\t') {
+		i = strtoul(text + 1, &end, 10);
+		if (*end != '\t' || i >= LENGTH(snext) - nmodules)
+			return;
+		n = MIN(strcspn(end + 1, "\t"), sizeof snext[i] - 1);
+		memcpy(snext[i], end + 1, n);
+		snext[i][n] = '\0';
+		return;
+	}
+	for (i = 0; i < LENGTH(snext) - nmodules; i++) {
+		n = strcspn(text, "\t");
+		memcpy(snext[i], text, MIN(n, sizeof snext[i] - 1));
+		snext[i][MIN(n, sizeof snext[i] - 1)] = '\0';
+		text += n + (text[n] == '\t');
+	}
+}
+
 void
 pop(Client *c)
 {
@@ -1231,14 +1554,16 @@ propertynotify(XEvent *e)
 			updatesizehints(c);
 			break;
 		case XA_WM_HINTS:
-			updatewmhints(c);
-			drawbars();
+			if (updatewmhints(c))
+				drawbar(c->mon);
 			break;
 		}
 		if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) {
-			updatetitle(c);
+			/* fetched once shown, once for any number of changes */
+			c->ntitle++;
+			c->titledirty = 1;
 			if (c == c->mon->sel)
-				drawbar(c->mon);
+				titlesdirty = 1;
 		}
 		if (ev->atom == netatom[NetWMWindowType])
 			updatewindowtype(c);
@@ -1251,6 +1576,34 @@ quit(const Arg *arg)
 	running = 0;
 }
 
+/* Parses every complete line available on statusfifo, the bar is updated
+ * from run() at most every statusdelay ms. */
+void
+readstatus(void)
+{
+	static char buf[sizeof stext];
+	static size_t len = 0;
+	char *p, *nl;
+	ssize_t n;
+
+	while ((n = read(sfifofd, buf + len, sizeof buf - len - 1)) > 0) {
+		len += n;
+		buf[len] = '\0';
+		for (p = buf; (nl = strchr(p, '\n')); p = nl + 1) {
+			*nl = '\0';
+			parsestatus(p);
+			sfifopending = 1;
+		}
+		len -= p - buf;
+		memmove(buf, p, len);
+		if (len == sizeof buf - 1) { /* overlong line, show what we have */
+			parsestatus(buf);
+			sfifopending = 1;
+			len = 0;
+		}
+	}
+}
+
 Monitor *
 recttomon(int x, int y, int w, int h)
 {
@@ -1365,19 +1718,107 @@ restack(Monitor *m)
 				wc.sibling = c->win;
 			}
 	}
+	updatestacking();
 	XSync(dpy, False);
 	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
 }
 
+void
+rulehit(int i, void *unused)
+{
+	if (rulestate[i].run != rulerun) {
+		rulestate[i].run = rulerun;
+		rulestate[i].got = 0;
+	}
+	if (++rulestate[i].got == rulestate[i].need)
+		rulehits[nrulehits++] = i;
+}
+
 void
 run(void)
 {
 	XEvent ev;
+	struct pollfd fds[] = {
+		{ .fd = ConnectionNumber(dpy), .events = POLLIN },
+		{ .fd = sfifofd, .events = POLLIN }, /* ignored if -1 */
+		{ .fd = -1, .events = POLLIN },      /* font worker */
+	};
+	long long now, wait, due;
+	unsigned int i, dirty;
+	Monitor *m;
+
 	/* main event loop */
 	XSync(dpy, False);
-	while (running && !XNextEvent(dpy, &ev))
-		if (handler[ev.type])
-			handler[ev.type](&ev); /* call handler */
+	while (running) {
+		while (running && XPending(dpy)) {
+			XNextEvent(dpy, &ev);
+			if (handler[ev.type])
+				handler[ev.type](&ev); /* call handler */
+		}
+		if (!running)
+			break;
+		now = mstime();
+		wait = -1;
+		for (i = dirty = 0; i < LENGTH(modules); i++) {
+			if (!modules[i].func)
+				continue;
+			if (modnext[i] <= now) {
+				dirty |= runmodule(i);
+				modnext[i] = now + modules[i].interval;
+			}
+			if (wait == -1 || modnext[i] - now < wait)
+				wait = modnext[i] - now;
+		}
+		if (dirty)
+			drawbar(selmon);
+		if (titlesdirty && (due = fetchtitles(now)) != -1 && (wait == -1 || due < wait))
+			wait = due;
+		if (sfifopending) {
+			if (sfifotime + statusdelay <= now) {
+				sfifopending = 0;
+				sfifotime = now;
+				setstatus();
+			} else if (wait == -1 || sfifotime + statusdelay - now < wait)
+				wait = sfifotime + statusdelay - now;
+		}
+		if (XPending(dpy)) /* drawing may have queued events */
+			continue;
+		fds[2].fd = drw->workfd;
+		if (poll(fds, LENGTH(fds), wait) == -1 && errno != EINTR)
+			die("poll:");
+		if (fds[1].revents & POLLIN)
+			readstatus();
+		if (dumpstats) {
+			dumpstats = 0;
+			stats();
+		}
+		if (fds[2].revents & POLLIN && drw_collect(drw)) {
+			for (m = mons; m; m = m->next)
+				for (i = 0; i < STATUSSEG(LENGTH(stext)); i++)
+					m->seg[i].state = ~0; /* drawn with other fonts */
+			drawbars();
+		}
+	}
+}
+
+/* Runs module i into its status block. Returns 1 if the block changed. */
+int
+runmodule(unsigned int i)
+{
+	char text[sizeof stext[0]] = "";
+	unsigned int j, b = LENGTH(stext) - nmodules;
+	const char *v;
+
+	for (j = 0; j < i; j++)
+		if (modules[j].func)
+			b++;
+	if ((v = modules[i].func(modules[i].arg)))
+		snprintf(text, sizeof text, modules[i].fmt, v);
+	if (!strcmp(stext[b], text))
+		return 0;
+	strcpy(stext[b], text);
+	strcpy(snext[b], text);
+	return 1;
 }
 
 void
@@ -1407,6 +1848,22 @@ scan(void)
 	}
 }
 
+/* Returns which of the n segments from first of m's bar shows x,
+ * counted from first, or -1. */
+int
+segat(Monitor *m, int first, int n, int x)
+{
+	int i;
+	Seg *s;
+
+	for (i = 0; i < n; i++) {
+		s = &m->seg[first + i];
+		if (x >= s->x && x < s->x + s->w)
+			return i;
+	}
+	return -1;
+}
+
 void
 sendmon(Client *c, Monitor *m)
 {
@@ -1511,6 +1968,22 @@ setlayout(const Arg *arg)
 		drawbar(selmon);
 }
 
+void
+setstatus(void)
+{
+	unsigned int i;
+	int changed = 0;
+
+	/* bytes after the terminators are left over from longer text */
+	for (i = 0; i < LENGTH(stext); i++)
+		if (strcmp(stext[i], snext[i])) {
+			strcpy(stext[i], snext[i]);
+			changed = 1;
+		}
+	if (changed)
+		drawbar(selmon);
+}
+
 /* arg > 1.0 will set mfact absolutely */
 void
 setmfact(const Arg *arg)
@@ -1530,49 +2003,74 @@ void
 setup(void)
 {
 	int i;
+	unsigned int j, n;
 	XSetWindowAttributes wa;
-	Atom utf8string;
+	struct stat st;
+	Atom utf8string, atoms[WMLast + NetLast + 1];
+	char *atomnames[LENGTH(atoms)];
 
 	/* clean up any zombies immediately */
 	sigchld(0);
+	if (signal(SIGUSR1, sigusr1) == SIG_ERR)
+		die("can't install SIGUSR1 handler:");
+	compilerules();
+	for (i = 0; i < LENGTH(modules); i++)
+		if (modules[i].func)
+			nmodules++;
 
 	/* init screen */
 	screen = DefaultScreen(dpy);
 	sw = DisplayWidth(dpy, screen);
 	sh = DisplayHeight(dpy, screen);
 	root = RootWindow(dpy, screen);
-	drw = drw_create(dpy, screen, root, sw, sh);
-	if (!drw_fontset_create(drw, fonts, LENGTH(fonts)))
+	drw = drw_create(dpy, screen, root);
+	/* only the first font is needed for the bar geometry */
+	if (!drw_fontset_load(drw, fonts, LENGTH(fonts)))
 		die("no fonts could be loaded.");
 	lrpad = drw->fonts->h;
 	bh = drw->fonts->h + 2;
+	startupmark("fonts");
 	updategeom();
-	/* init atoms */
-	utf8string = XInternAtom(dpy, "UTF8_STRING", False);
-	wmatom[WMProtocols] = XInternAtom(dpy, "WM_PROTOCOLS", False);
-	wmatom[WMDelete] = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
-	wmatom[WMState] = XInternAtom(dpy, "WM_STATE", False);
-	wmatom[WMTakeFocus] = XInternAtom(dpy, "WM_TAKE_FOCUS", False);
-	netatom[NetActiveWindow] = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
-	netatom[NetSupported] = XInternAtom(dpy, "_NET_SUPPORTED", False);
-	netatom[NetWMName] = XInternAtom(dpy, "_NET_WM_NAME", False);
-	netatom[NetWMState] = XInternAtom(dpy, "_NET_WM_STATE", False);
-	netatom[NetWMCheck] = XInternAtom(dpy, "_NET_SUPPORTING_WM_CHECK", False);
-	netatom[NetWMFullscreen] = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", False);
-	netatom[NetWMWindowType] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
-	netatom[NetWMWindowTypeDialog] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
-	netatom[NetClientList] = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
+	startupmark("geometry");
+	/* init atoms, in a single round trip */
+	for (i = 0; i < WMLast; i++)
+		atomnames[i] = (char *)wmatomnames[i];
+	for (i = 0; i < NetLast; i++)
+		atomnames[WMLast + i] = (char *)netatomnames[i];
+	atomnames[WMLast + NetLast] = "UTF8_STRING";
+	XInternAtoms(dpy, atomnames, LENGTH(atomnames), False, atoms);
+	memcpy(wmatom, atoms, sizeof wmatom);
+	memcpy(netatom, atoms + WMLast, sizeof netatom);
+	utf8string = atoms[WMLast + NetLast];
+	startupmark("atoms");
 	/* init cursors */
 	cursor[CurNormal] = drw_cur_create(drw, XC_left_ptr);
 	cursor[CurResize] = drw_cur_create(drw, XC_sizing);
 	cursor[CurMove] = drw_cur_create(drw, XC_fleur);
+	startupmark("cursors");
 	/* init appearance */
 	scheme = ecalloc(LENGTH(colors), sizeof(Clr *));
 	for (i = 0; i < LENGTH(colors); i++)
 		scheme[i] = drw_scm_create(drw, colors[i], 3);
+	startupmark("colors");
 	/* init bars */
 	updatebars();
 	updatestatus();
+	startupmark("bars");
+	/* status input besides the root window name */
+	if (statusfifo) {
+		if (mkfifo(statusfifo, 0600) == -1 && errno != EEXIST)
+			fprintf(stderr, "dwm: cannot create %s: %s\n", statusfifo, strerror(errno));
+		/* opened for writing too, so that writers closing it cause no EOF */
+		else if ((sfifofd = open(statusfifo, O_RDWR | O_NONBLOCK)) == -1)
+			fprintf(stderr, "dwm: cannot open %s: %s\n", statusfifo, strerror(errno));
+		/* a file left at the path would read as EOF forever */
+		else if (fstat(sfifofd, &st) == -1 || !S_ISFIFO(st.st_mode)) {
+			fprintf(stderr, "dwm: %s is not a named pipe\n", statusfifo);
+			close(sfifofd);
+			sfifofd = -1;
+		}
+	}
 	/* supporting window for NetWMCheck */
 	wmcheckwin = XCreateSimpleWindow(dpy, root, 0, 0, 1, 1, 0, 0, 0);
 	XChangeProperty(dpy, wmcheckwin, netatom[NetWMCheck], XA_WINDOW, 32,
@@ -1585,6 +2083,7 @@ setup(void)
 	XChangeProperty(dpy, root, netatom[NetSupported], XA_ATOM, 32,
 		PropModeReplace, (unsigned char *) netatom, NetLast);
 	XDeleteProperty(dpy, root, netatom[NetClientList]);
+	XDeleteProperty(dpy, root, netatom[NetClientListStacking]);
 	/* select events */
 	wa.cursor = cursor[CurNormal]->cursor;
 	wa.event_mask = SubstructureRedirectMask|SubstructureNotifyMask
@@ -1592,22 +2091,30 @@ setup(void)
 		|LeaveWindowMask|StructureNotifyMask|PropertyChangeMask;
 	XChangeWindowAttributes(dpy, root, CWEventMask|CWCursor, &wa);
 	XSelectInput(dpy, root, wa.event_mask);
+	updatenumlockmask();
+	updatebindings();
 	grabkeys();
+	/* buttons by click, they do not depend on the keyboard mapping */
+	for (i = n = 0; i < ClkLast; i++) {
+		buttonstart[i] = n;
+		for (j = 0; j < LENGTH(buttons); j++)
+			if (buttons[j].click == (unsigned int)i)
+				buttonidx[n++] = &buttons[j];
+	}
+	buttonstart[ClkLast] = n;
 	focus(NULL);
+	startupmark("setup");
 }
 
 
 void
 seturgent(Client *c, int urg)
 {
-	XWMHints *wmh;
-
 	c->isurgent = urg;
-	if (!(wmh = XGetWMHints(dpy, c->win)))
+	if (!c->hashints)
 		return;
-	wmh->flags = urg ? (wmh->flags | XUrgencyHint) : (wmh->flags & ~XUrgencyHint);
-	XSetWMHints(dpy, c->win, wmh);
-	XFree(wmh);
+	c->hints.flags = urg ? (c->hints.flags | XUrgencyHint) : (c->hints.flags & ~XUrgencyHint);
+	XSetWMHints(dpy, c->win, &c->hints);
 }
 
 void
@@ -1636,6 +2143,12 @@ sigchld(int unused)
 	while (0 < waitpid(-1, NULL, WNOHANG));
 }
 
+void
+sigusr1(int unused)
+{
+	dumpstats = 1;
+}
+
 void
 spawn(const Arg *arg)
 {
@@ -1644,6 +2157,8 @@ spawn(const Arg *arg)
 	if (fork() == 0) {
 		if (dpy)
 			close(ConnectionNumber(dpy));
+		if (sfifofd != -1)
+			close(sfifofd);
 		setsid();
 		execvp(((char **)arg->v)[0], (char **)arg->v);
 		fprintf(stderr, "dwm: execvp %s", ((char **)arg->v)[0]);
@@ -1652,6 +2167,47 @@ spawn(const Arg *arg)
 	}
 }
 
+/* Logs time and requests since the last mark if logstartup is set. */
+void
+startupmark(const char *phase)
+{
+	static long long t;
+	static unsigned long req;
+	long long now;
+
+	if (!logstartup)
+		return;
+	now = mstime();
+	if (phase)
+		fprintf(stderr, "dwm: startup: %s: %lld ms, %lu requests\n",
+		        phase, now - t, NextRequest(dpy) - req);
+	t = now;
+	req = NextRequest(dpy);
+}
+
+/* Prints counters to find out what keeps dwm busy, on SIGUSR1. */
+void
+stats(void)
+{
+	unsigned int i;
+	Client *c;
+	Monitor *m;
+	long long now = mstime();
+
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			fprintf(stderr, "dwm: stats: '%s': %lu title changes (%.2f/s), %lu fetched\n",
+			        c->name, c->ntitle, c->ntitle * 1000.0 / MAX(now - c->managed, 1), c->nfetch);
+	fprintf(stderr, "dwm: stats: %u fallback fonts (%lu kB glyph memory), "
+	        "%lu cached and %lu new lookups without a font\n",
+	        drw->nfallback, drw->fallbackmem / 1024, drw->nfhits, drw->nfmisses);
+	for (i = 0; i < LENGTH(rules); i++)
+		fprintf(stderr, "dwm: stats: rule %u (%s %s %s): %lu windows\n", i,
+		        rules[i].class ? rules[i].class : "-",
+		        rules[i].instance ? rules[i].instance : "-",
+		        rules[i].title ? rules[i].title : "-", rulestate[i].nmatch);
+}
+
 void
 tag(const Arg *arg)
 {
@@ -1764,9 +2320,13 @@ unmanage(Client *c, int destroyed)
 {
 	Monitor *m = c->mon;
 	XWindowChanges wc;
+	int i;
 
 	detach(c);
 	detachstack(c);
+	for (i = 0; clientlist[i] != c->win; i++)
+		;
+	memmove(&clientlist[i], &clientlist[i + 1], (--nclients - i) * sizeof(Window));
 	if (!destroyed) {
 		wc.border_width = c->oldbw;
 		XGrabServer(dpy); /* avoid race conditions */
@@ -1801,6 +2361,7 @@ unmapnotify(XEvent *e)
 void
 updatebars(void)
 {
+	unsigned int i;
 	Monitor *m;
 	XSetWindowAttributes wa = {
 		.override_redirect = True,
@@ -1809,6 +2370,12 @@ updatebars(void)
 	};
 	XClassHint ch = {"dwm", "dwm"};
 	for (m = mons; m; m = m->next) {
+		if (!m->buf || m->buf->w != m->ww) {
+			drw_buf_free(drw, m->buf);
+			m->buf = drw_buf_create(drw, m->ww, bh);
+			for (i = 0; i < STATUSSEG(LENGTH(stext)); i++)
+				m->seg[i].state = ~0; /* nothing drawn yet */
+		}
 		if (m->barwin)
 			continue;
 		m->barwin = XCreateWindow(dpy, root, m->wx, m->by, m->ww, bh, 0, DefaultDepth(dpy, screen),
@@ -1834,17 +2401,40 @@ updatebarpos(Monitor *m)
 }
 
 void
-updateclientlist()
+updatebindings(void)
 {
-	Client *c;
-	Monitor *m;
+	int min, max, per, k;
+	unsigned int i, n;
+	KeySym *syms;
 
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
-	for (m = mons; m; m = m->next)
-		for (c = m->clients; c; c = c->next)
-			XChangeProperty(dpy, root, netatom[NetClientList],
-				XA_WINDOW, 32, PropModeAppend,
-				(unsigned char *) &(c->win), 1);
+	/* keys by the keycode whose first keysym they name, counted first */
+	XDisplayKeycodes(dpy, &min, &max);
+	if (!(syms = XGetKeyboardMapping(dpy, min, max - min + 1, &per)))
+		return;
+	memset(keystart, 0, sizeof keystart);
+	for (k = min, n = 0; k <= max; k++)
+		for (i = 0; i < LENGTH(keys); i++)
+			if (keys[i].keysym == syms[(k - min) * per]) {
+				keystart[k + 1]++;
+				n++;
+			}
+	for (k = 0; k < 256; k++)
+		keystart[k + 1] += keystart[k];
+	if (!(keyidx = realloc(keyidx, (n ? n : 1) * sizeof(Key *))))
+		die("realloc:");
+	for (k = min, n = 0; k <= max; k++)
+		for (i = 0; i < LENGTH(keys); i++)
+			if (keys[i].keysym == syms[(k - min) * per])
+				keyidx[n++] = &keys[i];
+	XFree(syms);
+}
+
+void
+updateclientlist()
+{
+	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
+		PropModeReplace, (unsigned char *) clientlist, nclients);
+	updatestacking();
 }
 
 int
@@ -1984,12 +2574,37 @@ updatesizehints(Client *c)
 	c->isfixed = (c->maxw && c->maxh && c->maxw == c->minw && c->maxh == c->minh);
 }
 
+/* Sets _NET_CLIENT_LIST_STACKING, bottom to top, if it changed. The
+ * focus stacks come closest to the stacking order restack() sets up. */
+void
+updatestacking(void)
+{
+	Client *c;
+	Monitor *m;
+	int n = nclients, changed = nstacklist != nclients;
+
+	for (m = mons; m; m = m->next)
+		for (c = m->stack; c && n > 0; c = c->snext)
+			if (stacklist[--n] != c->win) {
+				stacklist[n] = c->win;
+				changed = 1;
+			}
+	if (!changed)
+		return;
+	nstacklist = nclients;
+	XChangeProperty(dpy, root, netatom[NetClientListStacking], XA_WINDOW, 32,
+		PropModeReplace, (unsigned char *) stacklist, nclients);
+}
+
 void
 updatestatus(void)
 {
-	if (!gettextprop(root, XA_WM_NAME, stext, sizeof(stext)))
-		strcpy(stext, "dwm-"VERSION);
-	drawbar(selmon);
+	char text[sizeof stext];
+
+	if (!gettextprop(root, XA_WM_NAME, text, sizeof(text)))
+		strcpy(text, "dwm-"VERSION);
+	parsestatus(text);
+	setstatus();
 }
 
 void
@@ -2013,23 +2628,30 @@ updatewindowtype(Client *c)
 		c->isfloating = 1;
 }
 
-void
+/* Returns 1 if the urgency of c changed. */
+int
 updatewmhints(Client *c)
 {
 	XWMHints *wmh;
+	int urg = c->isurgent;
 
-	if ((wmh = XGetWMHints(dpy, c->win))) {
-		if (c == selmon->sel && wmh->flags & XUrgencyHint) {
-			wmh->flags &= ~XUrgencyHint;
-			XSetWMHints(dpy, c->win, wmh);
-		} else
-			c->isurgent = (wmh->flags & XUrgencyHint) ? 1 : 0;
-		if (wmh->flags & InputHint)
-			c->neverfocus = !wmh->input;
-		else
-			c->neverfocus = 0;
-		XFree(wmh);
+	if (!(wmh = XGetWMHints(dpy, c->win))) {
+		c->hashints = 0;
+		return 0;
 	}
+	c->hints = *wmh;
+	c->hashints = 1;
+	XFree(wmh);
+	if (c == selmon->sel && c->hints.flags & XUrgencyHint) {
+		c->hints.flags &= ~XUrgencyHint;
+		XSetWMHints(dpy, c->win, &c->hints);
+	} else
+		c->isurgent = (c->hints.flags & XUrgencyHint) ? 1 : 0;
+	if (c->hints.flags & InputHint)
+		c->neverfocus = !c->hints.input;
+	else
+		c->neverfocus = 0;
+	return c->isurgent != urg;
 }
 
 void
@@ -2135,6 +2757,7 @@ main(int argc, char *argv[])
 		fputs("warning: no locale support\n", stderr);
 	if (!(dpy = XOpenDisplay(NULL)))
 		die("dwm: cannot open display");
+	startupmark(NULL);
 	checkotherwm();
 	setup();
 #ifdef __OpenBSD__
@@ -2142,6 +2765,7 @@ main(int argc, char *argv[])
 		die("pledge");
 #endif /* __OpenBSD__ */
 	scan();
+	startupmark("scan");
 	run();
 	cleanup();
 	XCloseDisplay(dpy);
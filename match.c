@@ -0,0 +1,223 @@
+/* See LICENSE file for copyright and license details. */
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "match.h"
+#include "util.h"
+
+typedef struct {
+	int id;
+	int next; /* next pattern of the same trie node or hash bucket */
+	unsigned long seen; /* run which last reported the pattern */
+	const char *exact; /* NULL for substrings */
+} Pat;
+
+typedef struct {
+	int edges;
+	int fail; /* longest proper suffix in the trie */
+	int link; /* longest proper suffix with patterns */
+	int out; /* patterns ending here */
+} Node;
+
+typedef struct {
+	unsigned char c;
+	int to;
+	int next;
+} Edge;
+
+typedef struct {
+	regex_t re;
+	int id;
+} Regex;
+
+/* substrings are found by an Aho-Corasick automaton over their trie,
+ * exact patterns are looked up by hash and regexes are tried in turn */
+struct Matcher {
+	Pat *pats;
+	int npats;
+	Node *nodes;
+	int nnodes;
+	Edge *edges;
+	int nedges;
+	int *buckets;
+	unsigned int nbuckets;
+	Regex *res;
+	int nres;
+	unsigned long run;
+};
+
+static void *
+grow(void *p, int n, size_t size)
+{
+	/* arrays double whenever their length reaches a power of two */
+	if (n & (n - 1))
+		return p;
+	if (!(p = realloc(p, (n ? 2 * n : 1) * size)))
+		die("realloc:");
+	return p;
+}
+
+static int
+child(const Matcher *m, int n, unsigned char c)
+{
+	int e;
+
+	for (e = m->nodes[n].edges; e != -1; e = m->edges[e].next)
+		if (m->edges[e].c == c)
+			return m->edges[e].to;
+	return -1;
+}
+
+static int
+newnode(Matcher *m)
+{
+	m->nodes = grow(m->nodes, m->nnodes, sizeof(Node));
+	m->nodes[m->nnodes].edges = -1;
+	m->nodes[m->nnodes].fail = 0;
+	m->nodes[m->nnodes].link = -1;
+	m->nodes[m->nnodes].out = -1;
+	return m->nnodes++;
+}
+
+static void
+report(Matcher *m, int p, void (*hit)(int id, void *arg), void *arg)
+{
+	for (; p != -1; p = m->pats[p].next)
+		if (m->pats[p].seen != m->run) {
+			m->pats[p].seen = m->run;
+			hit(m->pats[p].id, arg);
+		}
+}
+
+Matcher *
+matcher_create(void)
+{
+	Matcher *m = ecalloc(1, sizeof(Matcher));
+
+	newnode(m);
+	return m;
+}
+
+void
+matcher_free(Matcher *m)
+{
+	int i;
+
+	if (!m)
+		return;
+	for (i = 0; i < m->nres; i++)
+		regfree(&m->res[i].re);
+	free(m->pats);
+	free(m->nodes);
+	free(m->edges);
+	free(m->buckets);
+	free(m->res);
+	free(m);
+}
+
+/* the pattern is not copied, returns -1 if it is an invalid regex */
+int
+matcher_add(Matcher *m, const char *pattern, int id)
+{
+	const char *s;
+	int n, next, p;
+
+	if (pattern[0] == '~') {
+		m->res = grow(m->res, m->nres, sizeof(Regex));
+		if (regcomp(&m->res[m->nres].re, pattern + 1, REG_EXTENDED | REG_NOSUB))
+			return -1;
+		m->res[m->nres++].id = id;
+		return 0;
+	}
+	m->pats = grow(m->pats, m->npats, sizeof(Pat));
+	p = m->npats++;
+	m->pats[p].id = id;
+	m->pats[p].next = -1;
+	m->pats[p].seen = 0;
+	m->pats[p].exact = NULL;
+	if (pattern[0] == '=') {
+		m->pats[p].exact = pattern + 1;
+		return 0;
+	}
+	for (n = 0, s = pattern; *s; s++, n = next)
+		if ((next = child(m, n, *s)) == -1) {
+			next = newnode(m);
+			m->edges = grow(m->edges, m->nedges, sizeof(Edge));
+			m->edges[m->nedges].c = *s;
+			m->edges[m->nedges].to = next;
+			m->edges[m->nedges].next = m->nodes[n].edges;
+			m->nodes[n].edges = m->nedges++;
+		}
+	m->pats[p].next = m->nodes[n].out;
+	m->nodes[n].out = p;
+	return 0;
+}
+
+void
+matcher_compile(Matcher *m)
+{
+	int *queue, head, tail, e, f, n, next, p;
+	unsigned int i, h;
+
+	/* failure links, breadth-first so that shorter suffixes are done */
+	queue = ecalloc(m->nnodes, sizeof(int));
+	head = tail = 0;
+	queue[tail++] = 0;
+	while (head < tail) {
+		n = queue[head++];
+		for (e = m->nodes[n].edges; e != -1; e = m->edges[e].next) {
+			next = m->edges[e].to;
+			f = 0;
+			if (n) {
+				for (f = m->nodes[n].fail;
+				     f && child(m, f, m->edges[e].c) == -1;
+				     f = m->nodes[f].fail);
+				if ((f = child(m, f, m->edges[e].c)) == -1)
+					f = 0;
+			}
+			m->nodes[next].fail = f;
+			m->nodes[next].link = f && m->nodes[f].out != -1 ? f : m->nodes[f].link;
+			queue[tail++] = next;
+		}
+	}
+	free(queue);
+
+	/* exact patterns, in at least twice as many buckets */
+	for (m->nbuckets = 1; m->nbuckets < 2 * (unsigned int)m->npats; m->nbuckets *= 2);
+	free(m->buckets);
+	m->buckets = ecalloc(m->nbuckets, sizeof(int));
+	for (i = 0; i < m->nbuckets; i++)
+		m->buckets[i] = -1;
+	for (p = 0; p < m->npats; p++)
+		if (m->pats[p].exact) {
+			h = strhash(m->pats[p].exact) & (m->nbuckets - 1);
+			m->pats[p].next = m->buckets[h];
+			m->buckets[h] = p;
+		}
+}
+
+/* calls hit once for every pattern found in s */
+void
+matcher_run(Matcher *m, const char *s, void (*hit)(int id, void *arg), void *arg)
+{
+	const char *c;
+	int i, n, next, p;
+
+	m->run++;
+	report(m, m->nodes[0].out, hit, arg); /* empty substrings */
+	for (n = 0, c = s; *c; c++) {
+		while ((next = child(m, n, *c)) == -1 && n)
+			n = m->nodes[n].fail;
+		n = next == -1 ? 0 : next;
+		for (p = m->nodes[n].out != -1 ? n : m->nodes[n].link; p > 0; p = m->nodes[p].link)
+			report(m, m->nodes[p].out, hit, arg);
+	}
+	if (m->nbuckets)
+		for (p = m->buckets[strhash(s) & (m->nbuckets - 1)]; p != -1; p = m->pats[p].next)
+			if (!strcmp(m->pats[p].exact, s))
+				hit(m->pats[p].id, arg);
+	for (i = 0; i < m->nres; i++)
+		if (!regexec(&m->res[i].re, s, 0, NULL, 0))
+			hit(m->res[i].id, arg);
+}
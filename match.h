@@ -0,0 +1,11 @@
+/* See LICENSE file for copyright and license details. */
+
+/* multi-pattern string matcher: patterns are substrings, "=text" matches the
+ * whole string and "~regex" is a POSIX extended regular expression */
+typedef struct Matcher Matcher;
+
+Matcher *matcher_create(void);
+void matcher_free(Matcher *m);
+int matcher_add(Matcher *m, const char *pattern, int id);
+void matcher_compile(Matcher *m);
+void matcher_run(Matcher *m, const char *s, void (*hit)(int id, void *arg), void *arg);
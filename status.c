@@ -0,0 +1,106 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "status.h"
+
+static char buf[64]; /* value of the last module run */
+
+static int
+pscanf(const char *path, const char *fmt, ...)
+{
+	FILE *fp;
+	va_list ap;
+	int n;
+
+	if (!(fp = fopen(path, "r")))
+		return -1;
+	va_start(ap, fmt);
+	n = vfscanf(fp, fmt, ap);
+	va_end(ap);
+	fclose(fp);
+	return n;
+}
+
+const char *
+battery_perc(const char *bat)
+{
+	char path[128];
+	int perc;
+
+	snprintf(path, sizeof path, "/sys/class/power_supply/%s/capacity", bat);
+	if (pscanf(path, "%d", &perc) != 1)
+		return NULL;
+	snprintf(buf, sizeof buf, "%d", perc);
+	return buf;
+}
+
+/* busy share of the time since the last call */
+const char *
+cpu_perc(const char *unused)
+{
+	static unsigned long long pbusy, ptotal;
+	static int perc = -1;
+	unsigned long long a[7], busy, total;
+
+	if (pscanf("/proc/stat", "cpu %llu %llu %llu %llu %llu %llu %llu",
+	           &a[0], &a[1], &a[2], &a[3], &a[4], &a[5], &a[6]) != 7)
+		return NULL;
+	busy = a[0] + a[1] + a[2] + a[5] + a[6];
+	total = busy + a[3] + a[4];
+	if (ptotal && total != ptotal) /* the first sample is since boot */
+		perc = 100 * (busy - pbusy) / (total - ptotal);
+	pbusy = busy;
+	ptotal = total;
+	if (perc < 0)
+		return NULL;
+	snprintf(buf, sizeof buf, "%d", perc);
+	return buf;
+}
+
+const char *
+datetime(const char *fmt)
+{
+	time_t t = time(NULL);
+
+	if (!strftime(buf, sizeof buf, fmt, localtime(&t)))
+		return NULL;
+	return buf;
+}
+
+const char *
+load_avg(const char *unused)
+{
+	double avg[3];
+
+	if (getloadavg(avg, 3) != 3)
+		return NULL;
+	snprintf(buf, sizeof buf, "%.2f %.2f %.2f", avg[0], avg[1], avg[2]);
+	return buf;
+}
+
+const char *
+ram_perc(const char *unused)
+{
+	unsigned long total, avail;
+
+	if (pscanf("/proc/meminfo", "MemTotal: %lu kB\nMemFree: %*u kB\nMemAvailable: %lu kB",
+	           &total, &avail) != 2 || !total)
+		return NULL;
+	snprintf(buf, sizeof buf, "%d", (int)(100 * (total - avail) / total));
+	return buf;
+}
+
+/* file holds millidegrees Celsius, as in /sys/class/thermal */
+const char *
+temp(const char *file)
+{
+	int t;
+
+	if (pscanf(file, "%d", &t) != 1)
+		return NULL;
+	snprintf(buf, sizeof buf, "%d", t / 1000);
+	return buf;
+}
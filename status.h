@@ -0,0 +1,9 @@
+/* See LICENSE file for copyright and license details. */
+
+/* status modules, each returns NULL if its value is not available */
+const char *battery_perc(const char *bat);
+const char *cpu_perc(const char *unused);
+const char *datetime(const char *fmt);
+const char *load_avg(const char *unused);
+const char *ram_perc(const char *unused);
+const char *temp(const char *file);
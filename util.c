@@ -33,3 +33,14 @@ die(const char *fmt, ...) {
 
 	exit(1);
 }
+
+/* FNV-1a */
+unsigned int
+strhash(const char *s)
+{
+	unsigned int h = 2166136261u;
+
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}